@@ -0,0 +1,219 @@
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(PENV_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "codec.h"
+#include "defs.h"
+
+#define CODEC_EXCEPTION(msg) std::runtime_error("Codec:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        enum {
+            kMinMatch = 4,
+            kMaxOffset = 65535,
+            kHashBits = 14,
+            // 末尾若干字节只作字面量, 保证匹配检测的 4 字节读取不越界
+            kTailLiterals = 5
+        };
+
+        inline uint32_t Load32(const uint8_t * p) {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint64_t Load64(const uint8_t * p) {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        // 公共前缀长度, 每次比较 8 字节
+        inline size_t MatchLength(const uint8_t * p, const uint8_t * ref, const uint8_t * limit) {
+            const uint8_t * start = p;
+            while (p + sizeof(uint64_t) <= limit) {
+                uint64_t diff = Load64(p) ^ Load64(ref);
+                if (diff != 0) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                    return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+                    break;
+#endif
+                }
+                p += sizeof(uint64_t);
+                ref += sizeof(uint64_t);
+            }
+            while (p < limit && *p == *ref) {
+                ++p;
+                ++ref;
+            }
+            return p - start;
+        }
+
+        inline uint32_t HashSeq(uint32_t seq) {
+            return (seq * 2654435761U) >> (32 - kHashBits);
+        }
+
+        inline void PutLength(std::string * output, size_t len) {
+            while (len >= 255) {
+                output->push_back(static_cast<char>(255));
+                len -= 255;
+            }
+            output->push_back(static_cast<char>(len));
+        }
+
+        void EmitSequence(std::string * output, const uint8_t * literal, size_t literal_len,
+                          size_t offset, size_t match_len) {
+            size_t extra = match_len - kMinMatch;
+            uint8_t token = static_cast<uint8_t>((literal_len < 15 ? literal_len : 15) << 4);
+            if (match_len != 0) {
+                token |= extra < 15 ? extra : 15;
+            }
+            output->push_back(static_cast<char>(token));
+            if (literal_len >= 15) {
+                PutLength(output, literal_len - 15);
+            }
+            output->append(reinterpret_cast<const char *>(literal), literal_len);
+            if (match_len != 0) {
+                output->push_back(static_cast<char>(offset & 0xff));
+                output->push_back(static_cast<char>(offset >> 8));
+                if (extra >= 15) {
+                    PutLength(output, extra - 15);
+                }
+            }
+        }
+
+        inline bool GetLength(const uint8_t *& p, const uint8_t * limit, size_t * len) {
+            uint8_t b;
+            do {
+                if (p >= limit) {
+                    return false;
+                }
+                b = *p++;
+                *len += b;
+            } while (b == 255);
+            return true;
+        }
+    }
+
+    void LzCodec::Compress(const Slice & input, std::string * output) const {
+        const auto * begin = reinterpret_cast<const uint8_t *>(input.data());
+        const uint8_t * end = begin + input.size();
+        const uint8_t * anchor = begin;
+        output->reserve(output->size() + input.size() + input.size() / 255 + 16);
+        if (input.size() > kMinMatch + kTailLiterals) {
+            const uint8_t * limit = end - kTailLiterals;
+            std::vector<uint32_t> table(1 << kHashBits, UINT32_MAX);
+            const uint8_t * ip = begin;
+            while (ip + kMinMatch <= limit) {
+                uint32_t seq = Load32(ip);
+                uint32_t & slot = table[HashSeq(seq)];
+                const uint8_t * ref = slot == UINT32_MAX ? nullptr : begin + slot;
+                slot = static_cast<uint32_t>(ip - begin);
+                if (ref == nullptr || ip - ref > kMaxOffset || Load32(ref) != seq) {
+                    // 连续未命中时加大步长, 不可压缩数据不至于太慢
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+                size_t len = kMinMatch + MatchLength(ip + kMinMatch, ref + kMinMatch, limit);
+                EmitSequence(output, anchor, ip - anchor, ip - ref, len);
+                ip += len;
+                anchor = ip;
+            }
+        }
+        EmitSequence(output, anchor, end - anchor, 0, 0);
+    }
+
+    void LzCodec::Uncompress(const Slice & input, size_t raw_size, char * output) const {
+        const auto * ip = reinterpret_cast<const uint8_t *>(input.data());
+        const uint8_t * limit = ip + input.size();
+        auto * op = reinterpret_cast<uint8_t *>(output);
+        uint8_t * op_limit = op + raw_size;
+        while (ip < limit) {
+            uint8_t token = *ip++;
+            size_t literal_len = token >> 4;
+            if (literal_len == 15 && !GetLength(ip, limit, &literal_len)) {
+                break;
+            }
+            if (literal_len > static_cast<size_t>(limit - ip) || literal_len > static_cast<size_t>(op_limit - op)) {
+                break;
+            }
+            memcpy(op, ip, literal_len);
+            ip += literal_len;
+            op += literal_len;
+            if (ip == limit) {
+                if (op == op_limit) {
+                    return;
+                }
+                break;
+            }
+
+            if (limit - ip < 2) {
+                break;
+            }
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            size_t match_len = token & 0x0f;
+            if (match_len == 15 && !GetLength(ip, limit, &match_len)) {
+                break;
+            }
+            match_len += kMinMatch;
+            if (offset == 0 || offset > static_cast<size_t>(op - reinterpret_cast<uint8_t *>(output)) ||
+                match_len > static_cast<size_t>(op_limit - op)) {
+                break;
+            }
+            const uint8_t * ref = op - offset;
+            if (offset >= match_len) {
+                memcpy(op, ref, match_len);
+            } else {
+                // 源与目标重叠, 逐字节复制
+                for (size_t i = 0; i < match_len; ++i) {
+                    op[i] = ref[i];
+                }
+            }
+            op += match_len;
+        }
+        throw CODEC_EXCEPTION("corrupted lz block");
+    }
+
+#if defined(PENV_HAVE_ZLIB)
+
+    void ZlibCodec::Compress(const Slice & input, std::string * output) const {
+        size_t pos = output->size();
+        uLongf len = compressBound(static_cast<uLong>(input.size()));
+        output->resize(pos + len);
+        int r = compress2(reinterpret_cast<Bytef *>(&(*output)[pos]), &len,
+                          reinterpret_cast<const Bytef *>(input.data()), static_cast<uLong>(input.size()), level_);
+        if (r != Z_OK) {
+            throw CODEC_EXCEPTION("zlib compress2 error " + std::to_string(r));
+        }
+        output->resize(pos + len);
+    }
+
+    void ZlibCodec::Uncompress(const Slice & input, size_t raw_size, char * output) const {
+        auto len = static_cast<uLongf>(raw_size);
+        int r = uncompress(reinterpret_cast<Bytef *>(output), &len,
+                           reinterpret_cast<const Bytef *>(input.data()), static_cast<uLong>(input.size()));
+        if (r != Z_OK || len != raw_size) {
+            throw CODEC_EXCEPTION("corrupted zlib block, error " + std::to_string(r));
+        }
+    }
+
+#endif
+
+    const Codec * BuiltinCodec(uint32_t id) {
+        static const LzCodec lz;
+#if defined(PENV_HAVE_ZLIB)
+        static const ZlibCodec zlib;
+        if (id == ZlibCodec::kId) {
+            return &zlib;
+        }
+#endif
+        return id == LzCodec::kId ? &lz : nullptr;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef POSIX_ENV_CODEC_H
+#define POSIX_ENV_CODEC_H
+
+/*
+ * 块压缩算法
+ * Id 取 1~255, 作为块类型写入压缩文件的每个块, 读取时据此选择内置实现
+ */
+
+#include <string>
+
+#include "slice.h"
+
+namespace penv {
+    class Codec {
+    public:
+        Codec() = default;
+
+        virtual ~Codec() = default;
+
+    public:
+        virtual uint32_t Id() const = 0;
+
+        virtual const char * Name() const = 0;
+
+        // 压缩结果追加到 output 之后
+        virtual void Compress(const Slice & input, std::string * output) const = 0;
+
+        // raw_size 为压缩前大小, 输入损坏时抛出异常
+        virtual void Uncompress(const Slice & input, size_t raw_size, char * output) const = 0;
+    };
+
+    // LZ77, 格式类似 LZ4 block: token(字面量长度 | 匹配长度) + 字面量 + 16 位偏移
+    // 速度优先, 压缩率低于 zlib
+    class LzCodec : public Codec {
+    public:
+        enum {
+            kId = 1
+        };
+
+        uint32_t Id() const override {
+            return kId;
+        }
+
+        const char * Name() const override {
+            return "lz";
+        }
+
+        void Compress(const Slice & input, std::string * output) const override;
+
+        void Uncompress(const Slice & input, size_t raw_size, char * output) const override;
+    };
+
+#if defined(PENV_HAVE_ZLIB)
+
+    class ZlibCodec : public Codec {
+    private:
+        int level_;
+
+    public:
+        enum {
+            kId = 2
+        };
+
+        // level 同 zlib, -1 为默认级别
+        explicit ZlibCodec(int level = -1)
+                : level_(level) {}
+
+    public:
+        uint32_t Id() const override {
+            return kId;
+        }
+
+        const char * Name() const override {
+            return "zlib";
+        }
+
+        void Compress(const Slice & input, std::string * output) const override;
+
+        void Uncompress(const Slice & input, size_t raw_size, char * output) const override;
+    };
+
+#endif
+
+    // 按 Id 返回内置实现, 未知或未编译进来时返回 nullptr
+    const Codec * BuiltinCodec(uint32_t id);
+}
+
+#endif //POSIX_ENV_CODEC_H
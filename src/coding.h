@@ -0,0 +1,94 @@
+#pragma once
+#ifndef POSIX_ENV_CODING_H
+#define POSIX_ENV_CODING_H
+
+/*
+ * 定长/变长整数编解码, 小端序
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace penv {
+    inline void EncodeFixed32(char * dst, uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            dst[i] = static_cast<char>(v >> (8 * i));
+        }
+    }
+
+    inline void EncodeFixed64(char * dst, uint64_t v) {
+        for (int i = 0; i < 8; ++i) {
+            dst[i] = static_cast<char>(v >> (8 * i));
+        }
+    }
+
+    inline uint32_t DecodeFixed32(const char * src) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v |= static_cast<uint32_t>(static_cast<uint8_t>(src[i])) << (8 * i);
+        }
+        return v;
+    }
+
+    inline uint64_t DecodeFixed64(const char * src) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) {
+            v |= static_cast<uint64_t>(static_cast<uint8_t>(src[i])) << (8 * i);
+        }
+        return v;
+    }
+
+    inline void PutFixed32(std::string * dst, uint32_t v) {
+        char buf[4];
+        EncodeFixed32(buf, v);
+        dst->append(buf, sizeof(buf));
+    }
+
+    inline void PutFixed64(std::string * dst, uint64_t v) {
+        char buf[8];
+        EncodeFixed64(buf, v);
+        dst->append(buf, sizeof(buf));
+    }
+
+    inline void PutVarint64(std::string * dst, uint64_t v) {
+        char buf[10];
+        size_t n = 0;
+        while (v >= 0x80) {
+            buf[n++] = static_cast<char>(v | 0x80);
+            v >>= 7;
+        }
+        buf[n++] = static_cast<char>(v);
+        dst->append(buf, n);
+    }
+
+    inline void PutVarint32(std::string * dst, uint32_t v) {
+        PutVarint64(dst, v);
+    }
+
+    // 失败(越界或过长)时返回 nullptr
+    inline const char * GetVarint64(const char * p, const char * limit, uint64_t * v) {
+        uint64_t result = 0;
+        for (uint32_t shift = 0; shift <= 63 && p < limit; shift += 7) {
+            auto byte = static_cast<uint8_t>(*p++);
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                *v = result;
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    inline const char * GetVarint32(const char * p, const char * limit, uint32_t * v) {
+        uint64_t result;
+        p = GetVarint64(p, limit, &result);
+        if (p == nullptr || result > UINT32_MAX) {
+            return nullptr;
+        }
+        *v = static_cast<uint32_t>(result);
+        return p;
+    }
+}
+
+#endif //POSIX_ENV_CODING_H
@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "coding.h"
+#include "compressed_file.h"
+#include "defs.h"
+#include "hash.h"
+
+#define COMPRESSION_EXCEPTION(msg) std::runtime_error("Compression:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr uint64_t kCompressedMagic = 0x5a4c4356454e50ULL; // "PENVCLZ"
+        // index offset, index size, raw size, block 数与 codec id, magic
+        constexpr size_t kFooterSize = 5 * sizeof(uint64_t);
+
+        // 存储大小、原始大小、校验值
+        constexpr size_t kBlockHeaderSize = 3 * sizeof(uint32_t);
+
+        // 其余取值为 codec id
+        constexpr uint8_t kRawBlock = 0;
+
+        // 大小也参与校验, 全零的尾部不会被当成合法块
+        uint32_t BlockCheck(const char * data, size_t size, size_t raw_size) {
+            return static_cast<uint32_t>(Hash64(data, size, (static_cast<uint64_t>(size) << 32) ^ raw_size));
+        }
+    }
+
+    CompressedWritableFile::CompressedWritableFile(std::unique_ptr<WritableFile> file, const Codec * codec,
+                                                   size_t block_size)
+            : file_(std::move(file)),
+              codec_(codec),
+              block_size_(block_size),
+              raw_size_(0),
+              num_blocks_(0),
+              finished_(false) {
+        assert(block_size_ > 0 && block_size_ <= UINT32_MAX);
+        assert(codec_->Id() != kRawBlock && codec_->Id() <= UINT8_MAX);
+        // 块偏移从 0 开始计, 不能接在已有内容之后
+        if (file_->GetFileSize() != 0) {
+            throw COMPRESSION_EXCEPTION("target file is not empty");
+        }
+        buffer_.reserve(block_size_);
+    }
+
+    CompressedWritableFile::~CompressedWritableFile() {
+        if (!finished_) {
+            try {
+                Finish();
+            } catch (const std::exception &) {
+            }
+        }
+    }
+
+    void CompressedWritableFile::Finish() {
+        if (finished_) {
+            return;
+        }
+        if (!buffer_.empty()) {
+            FlushBlock(buffer_);
+            buffer_.clear();
+        }
+        uint64_t index_offset = file_->GetFileSize();
+        uint64_t index_size = index_.size();
+        PutFixed64(&index_, index_offset);
+        PutFixed64(&index_, index_size);
+        PutFixed64(&index_, raw_size_);
+        PutFixed32(&index_, static_cast<uint32_t>(num_blocks_));
+        PutFixed32(&index_, codec_->Id());
+        PutFixed64(&index_, kCompressedMagic);
+        file_->Write(index_);
+        finished_ = true;
+    }
+
+    void CompressedWritableFile::Write(const Slice & data) {
+        if (finished_) {
+            throw COMPRESSION_EXCEPTION("write after finish");
+        }
+        const char * p = data.data();
+        size_t left = data.size();
+        while (left != 0) {
+            // 缓冲为空时整块直接压缩, 省一次复制
+            if (buffer_.empty() && left >= block_size_) {
+                FlushBlock(Slice(p, block_size_));
+                p += block_size_;
+                left -= block_size_;
+                continue;
+            }
+            size_t n = std::min(left, block_size_ - buffer_.size());
+            buffer_.append(p, n);
+            p += n;
+            left -= n;
+            if (buffer_.size() == block_size_) {
+                FlushBlock(buffer_);
+                buffer_.clear();
+            }
+        }
+        raw_size_ += data.size();
+    }
+
+    void CompressedWritableFile::Truncate(size_t n) {
+        if (n != raw_size_) {
+            throw COMPRESSION_EXCEPTION("truncate not supported");
+        }
+    }
+
+    void CompressedWritableFile::Sync() {
+        if (!finished_ && !buffer_.empty()) {
+            FlushBlock(buffer_);
+            buffer_.clear();
+        }
+        file_->Sync();
+    }
+
+    void CompressedWritableFile::Hint(WriteLifeTimeHint hint) {
+        file_->Hint(hint);
+    }
+
+    void CompressedWritableFile::RangeSync(size_t, size_t) {
+        // 只能同步已写出的块
+        file_->RangeSync(0, file_->GetFileSize());
+    }
+
+    void CompressedWritableFile::Allocate(size_t, size_t) {
+        throw COMPRESSION_EXCEPTION("allocate not supported");
+    }
+
+    void CompressedWritableFile::PunchHole(size_t, size_t) {
+        throw COMPRESSION_EXCEPTION("punch hole not supported");
+    }
+
+    void CompressedWritableFile::CollapseRange(size_t, size_t) {
+        throw COMPRESSION_EXCEPTION("collapse range not supported");
+    }
+
+    void CompressedWritableFile::InsertRange(size_t, size_t) {
+        throw COMPRESSION_EXCEPTION("insert range not supported");
+    }
+
+    void CompressedWritableFile::ZeroRange(size_t, size_t) {
+        throw COMPRESSION_EXCEPTION("zero range not supported");
+    }
+
+    void CompressedWritableFile::FlushBlock(const Slice & raw) {
+        compressed_.assign(kBlockHeaderSize, '\0');
+        codec_->Compress(raw, &compressed_);
+        auto type = static_cast<uint8_t>(codec_->Id());
+        if (compressed_.size() - kBlockHeaderSize >= raw.size() - raw.size() / 8) {
+            compressed_.resize(kBlockHeaderSize);
+            compressed_.append(raw.data(), raw.size());
+            type = kRawBlock;
+        }
+        compressed_.push_back(static_cast<char>(type));
+        size_t size = compressed_.size() - kBlockHeaderSize;
+        EncodeFixed32(&compressed_[0], static_cast<uint32_t>(size));
+        EncodeFixed32(&compressed_[4], static_cast<uint32_t>(raw.size()));
+        EncodeFixed32(&compressed_[8], BlockCheck(compressed_.data() + kBlockHeaderSize, size, raw.size()));
+        file_->Write(compressed_);
+        PutVarint64(&index_, raw.size());
+        PutVarint64(&index_, compressed_.size());
+        ++num_blocks_;
+    }
+
+    CompressedRandomAccessFile::CompressedRandomAccessFile(std::unique_ptr<RandomAccessFile> file, size_t file_size,
+                                                           size_t cache_blocks, const Codec * codec)
+            : file_(std::move(file)),
+              codec_(codec),
+              complete_(false),
+              cache_(cache_blocks),
+              tick_(0) {
+        raw_offsets_.emplace_back(0);
+        offsets_.emplace_back(0);
+        complete_ = ReadIndex(file_size);
+        if (!complete_) {
+            Recover(file_size);
+        }
+    }
+
+    bool CompressedRandomAccessFile::ReadIndex(size_t file_size) {
+        if (file_size < kFooterSize) {
+            return false;
+        }
+        char footer[kFooterSize];
+        file_->ReadAt(file_size - kFooterSize, kFooterSize, footer);
+        if (DecodeFixed64(footer + 32) != kCompressedMagic) {
+            return false;
+        }
+        uint64_t index_offset = DecodeFixed64(footer);
+        uint64_t index_size = DecodeFixed64(footer + 8);
+        uint64_t raw_size = DecodeFixed64(footer + 16);
+        uint32_t num_blocks = DecodeFixed32(footer + 24);
+        uint32_t codec_id = DecodeFixed32(footer + 28);
+        if (index_offset + index_size + kFooterSize != file_size) {
+            throw COMPRESSION_EXCEPTION("bad footer");
+        }
+        SetCodec(codec_id);
+
+        std::string index(index_size, '\0');
+        file_->ReadAt(index_offset, index_size, &index[0]);
+        const char * p = index.data();
+        const char * limit = p + index.size();
+        raw_offsets_.reserve(num_blocks + 1);
+        offsets_.reserve(num_blocks + 1);
+        for (uint32_t i = 0; i < num_blocks; ++i) {
+            uint64_t raw_block_size;
+            uint64_t block_size;
+            p = GetVarint64(p, limit, &raw_block_size);
+            if (p != nullptr) {
+                p = GetVarint64(p, limit, &block_size);
+            }
+            if (p == nullptr || block_size <= kBlockHeaderSize) {
+                throw COMPRESSION_EXCEPTION("bad block index");
+            }
+            raw_offsets_.emplace_back(raw_offsets_.back() + raw_block_size);
+            offsets_.emplace_back(offsets_.back() + block_size);
+        }
+        if (raw_offsets_.back() != raw_size || offsets_.back() != index_offset) {
+            throw COMPRESSION_EXCEPTION("bad block index");
+        }
+        return true;
+    }
+
+    void CompressedRandomAccessFile::Recover(size_t file_size) {
+        std::string buffer;
+        size_t offset = 0;
+        while (offset + kBlockHeaderSize < file_size) {
+            char header[kBlockHeaderSize];
+            file_->ReadAt(offset, kBlockHeaderSize, header);
+            size_t size = DecodeFixed32(header);
+            size_t raw_size = DecodeFixed32(header + 4);
+            if (size == 0 || size > file_size - offset - kBlockHeaderSize) {
+                break;
+            }
+            buffer.resize(size);
+            file_->ReadAt(offset + kBlockHeaderSize, size, &buffer[0]);
+            if (DecodeFixed32(header + 8) != BlockCheck(buffer.data(), size, raw_size)) {
+                break;
+            }
+            auto type = static_cast<uint8_t>(buffer.back());
+            if (type != kRawBlock && (codec_ == nullptr || codec_->Id() != type)) {
+                SetCodec(type);
+            }
+            offset += kBlockHeaderSize + size;
+            raw_offsets_.emplace_back(raw_offsets_.back() + raw_size);
+            offsets_.emplace_back(offset);
+        }
+    }
+
+    void CompressedRandomAccessFile::SetCodec(uint32_t id) {
+        if (codec_ == nullptr) {
+            codec_ = BuiltinCodec(id);
+            if (codec_ == nullptr) {
+                throw COMPRESSION_EXCEPTION("unknown codec " + std::to_string(id));
+            }
+        } else if (codec_->Id() != id) {
+            throw COMPRESSION_EXCEPTION(std::string("codec mismatch, ") + codec_->Name());
+        }
+    }
+
+    void CompressedRandomAccessFile::ReadAt(size_t offset, size_t n, char * scratch) const {
+        if (n == 0) {
+            return;
+        }
+        if (offset > GetFileSize() || n > GetFileSize() - offset) {
+            throw COMPRESSION_EXCEPTION("read past end of file");
+        }
+        size_t first;
+        size_t last;
+        BlockRange(offset, n, &first, &last);
+        for (size_t block = first; block < last; ++block) {
+            size_t begin = raw_offsets_[block];
+            size_t end = raw_offsets_[block + 1];
+            size_t from = std::max(offset, begin);
+            size_t to = std::min(offset + n, end);
+            char * dst = scratch + (from - offset);
+            // 整块读取时未命中缓存则直接解压到 scratch, 不占缓存
+            std::shared_ptr<const std::string> data = Lookup(block);
+            if (data == nullptr && from == begin && to == end) {
+                ReadBlock(block, dst);
+                continue;
+            }
+            if (data == nullptr) {
+                auto decoded = std::make_shared<std::string>(end - begin, '\0');
+                ReadBlock(block, &(*decoded)[0]);
+                data = decoded;
+                Insert(block, data);
+            }
+            memcpy(dst, data->data() + (from - begin), to - from);
+        }
+    }
+
+    void CompressedRandomAccessFile::Prefetch(size_t offset, size_t n) {
+        size_t begin;
+        size_t len;
+        if (StoredRange(offset, n, &begin, &len)) {
+            file_->Prefetch(begin, len);
+        }
+    }
+
+    void CompressedRandomAccessFile::Hint(AccessPattern hint) {
+        file_->Hint(hint);
+    }
+
+    void CompressedRandomAccessFile::RangeHint(size_t offset, size_t n, AccessPattern hint) {
+        size_t begin;
+        size_t len;
+        if (StoredRange(offset, n, &begin, &len)) {
+            file_->RangeHint(begin, len, hint);
+        }
+    }
+
+    size_t CompressedRandomAccessFile::GetResidentSize(size_t offset, size_t n) const {
+        std::vector<std::pair<size_t, size_t>> ranges;
+        GetResidentRanges(offset, n, &ranges);
+        size_t resident = 0;
+        for (const auto & range : ranges) {
+            resident += range.second;
+        }
+        return resident;
+    }
+
+    void CompressedRandomAccessFile::GetResidentRanges(size_t offset, size_t n,
+                                                       std::vector<std::pair<size_t, size_t>> * result) const {
+        result->clear();
+        size_t begin;
+        size_t len;
+        if (!StoredRange(offset, n, &begin, &len)) {
+            return;
+        }
+        std::vector<std::pair<size_t, size_t>> stored;
+        file_->GetResidentRanges(begin, len, &stored);
+
+        size_t end = (n == 0 || n > GetFileSize() - offset) ? GetFileSize() : offset + n;
+        size_t first;
+        size_t last;
+        BlockRange(offset, end - offset, &first, &last);
+        auto range = stored.cbegin();
+        for (size_t block = first; block < last; ++block) {
+            while (range != stored.cend() && range->first + range->second <= offsets_[block]) {
+                ++range;
+            }
+            if (range == stored.cend()) {
+                break;
+            }
+            // 相邻的驻留区间已合并, 块须落在同一区间内
+            if (range->first > offsets_[block] || range->first + range->second < offsets_[block + 1]) {
+                continue;
+            }
+            size_t from = std::max<size_t>(offset, raw_offsets_[block]);
+            size_t to = std::min<size_t>(end, raw_offsets_[block + 1]);
+            if (!result->empty() && result->back().first + result->back().second == from) {
+                result->back().second += to - from;
+            } else {
+                result->emplace_back(from, to - from);
+            }
+        }
+    }
+
+    void CompressedRandomAccessFile::BlockRange(size_t offset, size_t n, size_t * first, size_t * last) const {
+        *first = std::upper_bound(raw_offsets_.cbegin(), raw_offsets_.cend(), offset) - raw_offsets_.cbegin() - 1;
+        *last = std::lower_bound(raw_offsets_.cbegin(), raw_offsets_.cend(), offset + n) - raw_offsets_.cbegin();
+    }
+
+    bool CompressedRandomAccessFile::StoredRange(size_t offset, size_t n, size_t * begin, size_t * len) const {
+        if (offset >= GetFileSize()) {
+            return false;
+        }
+        if (n == 0 || n > GetFileSize() - offset) {
+            n = GetFileSize() - offset;
+        }
+        size_t first;
+        size_t last;
+        BlockRange(offset, n, &first, &last);
+        *begin = offsets_[first];
+        *len = offsets_[last] - offsets_[first];
+        return true;
+    }
+
+    void CompressedRandomAccessFile::ReadBlock(size_t block, char * output) const {
+        size_t size = offsets_[block + 1] - offsets_[block];
+        size_t raw_size = raw_offsets_[block + 1] - raw_offsets_[block];
+        std::string buffer(size, '\0');
+        file_->ReadAt(offsets_[block], size, &buffer[0]);
+        size_t stored = size - kBlockHeaderSize;
+        if (DecodeFixed32(buffer.data()) != stored || DecodeFixed32(buffer.data() + 4) != raw_size ||
+            DecodeFixed32(buffer.data() + 8) != BlockCheck(buffer.data() + kBlockHeaderSize, stored, raw_size)) {
+            throw COMPRESSION_EXCEPTION("block checksum mismatch " + std::to_string(block));
+        }
+        Slice contents(buffer.data() + kBlockHeaderSize, stored - 1);
+        auto type = static_cast<uint8_t>(buffer.back());
+        if (type == kRawBlock && contents.size() == raw_size) {
+            memcpy(output, contents.data(), raw_size);
+        } else if (type != kRawBlock && codec_ != nullptr && type == codec_->Id()) {
+            codec_->Uncompress(contents, raw_size, output);
+        } else {
+            throw COMPRESSION_EXCEPTION("bad block " + std::to_string(block));
+        }
+    }
+
+    std::shared_ptr<const std::string> CompressedRandomAccessFile::Lookup(size_t block) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (CachedBlock & cached : cache_) {
+            if (cached.block == block) {
+                cached.tick = ++tick_;
+                return cached.data;
+            }
+        }
+        return nullptr;
+    }
+
+    void CompressedRandomAccessFile::Insert(size_t block, std::shared_ptr<const std::string> data) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cache_.empty()) {
+            return;
+        }
+        // 块数很少, 线性查找最久未用的一项
+        CachedBlock * victim = &cache_.front();
+        for (CachedBlock & cached : cache_) {
+            if (cached.block == block) {
+                return;
+            }
+            if (cached.tick < victim->tick) {
+                victim = &cached;
+            }
+        }
+        victim->block = block;
+        victim->tick = ++tick_;
+        victim->data = std::move(data);
+    }
+}
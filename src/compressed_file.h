@@ -0,0 +1,169 @@
+#pragma once
+#ifndef POSIX_ENV_COMPRESSED_FILE_H
+#define POSIX_ENV_COMPRESSED_FILE_H
+
+/*
+ * 分块压缩文件, 支持按原始偏移随机读
+ *
+ * 文件布局:
+ * [block header][block][type]...[block index][footer]
+ *
+ * 原始数据按 block_size 切块后分别压缩, 压缩收益不足 1/8 的块原样存储
+ * type 为 0 表示原样存储, 否则为 codec id
+ * block header 为 fixed32 的存储大小(含 type)、原始大小与校验值, 块可以自描述
+ * Sync 会提前结束当前块, 因此块的原始大小不固定, 由索引记录
+ * block index 为每块的 varint64 原始大小与存储大小(含 header)
+ * footer 定长, 记录索引位置、原始总大小与 codec id
+ *
+ * 没有 footer 的文件(写入过程中崩溃)打开时逐块扫描校验, 恢复到最后一个完整的块,
+ * 即至少包含最后一次 Sync 之前写入的数据
+ */
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "codec.h"
+#include "env.h"
+
+namespace penv {
+    // 追加写的压缩装饰器, Finish(或析构)时写出索引与 footer
+    // file 须为空文件; 不支持截断、预分配与区间操作, 调用时抛出异常
+    class CompressedWritableFile : public WritableFile {
+    private:
+        std::unique_ptr<WritableFile> file_;
+        const Codec * codec_;
+        size_t block_size_;
+        std::string buffer_;
+        std::string compressed_;
+        std::string index_;
+        size_t raw_size_;
+        size_t num_blocks_;
+        bool finished_;
+
+    public:
+        CompressedWritableFile(std::unique_ptr<WritableFile> file, const Codec * codec,
+                               size_t block_size = 64 * 1024);
+
+        ~CompressedWritableFile() override;
+
+    public:
+        void Finish();
+
+    public:
+        void Write(const Slice & data) override;
+
+        void Truncate(size_t n) override;
+
+        // 当前块提前结束并写出, 崩溃后可恢复到此处
+        void Sync() override;
+
+        size_t GetFileSize() const override {
+            return raw_size_;
+        }
+
+        void Hint(WriteLifeTimeHint hint) override;
+
+        void RangeSync(size_t offset, size_t n) override;
+
+        // 原始偏移无法对应到压缩后的位置, 忽略
+        void PrepareWrite(size_t, size_t) override {}
+
+        void Allocate(size_t offset, size_t n) override;
+
+        void PunchHole(size_t offset, size_t n) override;
+
+        void CollapseRange(size_t offset, size_t n) override;
+
+        void InsertRange(size_t offset, size_t n) override;
+
+        void ZeroRange(size_t offset, size_t n) override;
+
+    private:
+        void FlushBlock(const Slice & raw);
+    };
+
+    // ReadAt 只解压涉及的块, 最近解压的块缓存在内存中
+    // 偏移与长度均为原始数据的坐标
+    class CompressedRandomAccessFile : public RandomAccessFile {
+    private:
+        struct CachedBlock {
+            size_t block = SIZE_MAX;
+            uint64_t tick = 0;
+            std::shared_ptr<const std::string> data;
+        };
+
+        std::unique_ptr<RandomAccessFile> file_;
+        const Codec * codec_;
+        // 第 i 块的原始起点与存储起点, 末尾各多一项作哨兵
+        std::vector<uint64_t> raw_offsets_;
+        std::vector<uint64_t> offsets_;
+
+        bool complete_;
+
+        mutable std::mutex mutex_;
+        mutable std::vector<CachedBlock> cache_;
+        mutable uint64_t tick_;
+
+    public:
+        // codec 为空时按 footer 中的 id 选择内置实现; cache_blocks == 0 关闭缓存
+        CompressedRandomAccessFile(std::unique_ptr<RandomAccessFile> file, size_t file_size,
+                                   size_t cache_blocks = 8, const Codec * codec = nullptr);
+
+    public:
+        size_t GetFileSize() const {
+            return raw_offsets_.back();
+        }
+
+        // false 表示文件没有 footer, 内容由逐块扫描恢复
+        bool complete() const {
+            return complete_;
+        }
+
+        void ReadAt(size_t offset, size_t n, char * scratch) const override;
+
+        void Prefetch(size_t offset, size_t n) override;
+
+        void Hint(AccessPattern hint) override;
+
+        void RangeHint(size_t offset, size_t n, AccessPattern hint) override;
+
+        // 只统计存储字节全部驻留的块
+        size_t GetResidentSize(size_t offset, size_t n) const override;
+
+        void GetResidentRanges(size_t offset, size_t n,
+                               std::vector<std::pair<size_t, size_t>> * result) const override;
+
+        // 原始数据没有空洞
+        size_t SeekData(size_t offset) const override {
+            return std::min<size_t>(offset, GetFileSize());
+        }
+
+        size_t SeekHole(size_t) const override {
+            return GetFileSize();
+        }
+
+    private:
+        // 读取 footer 与索引, 没有 footer 时返回 false
+        bool ReadIndex(size_t file_size);
+
+        void Recover(size_t file_size);
+
+        void SetCodec(uint32_t id);
+
+        // 返回原始区间 [offset, offset + n) 涉及的块 [first, last)
+        void BlockRange(size_t offset, size_t n, size_t * first, size_t * last) const;
+
+        // 原始区间对应的存储区间, n == 0 表示直到末尾; offset 越界时返回 false
+        bool StoredRange(size_t offset, size_t n, size_t * begin, size_t * len) const;
+
+        void ReadBlock(size_t block, char * output) const;
+
+        std::shared_ptr<const std::string> Lookup(size_t block) const;
+
+        void Insert(size_t block, std::shared_ptr<const std::string> data) const;
+    };
+}
+
+#endif //POSIX_ENV_COMPRESSED_FILE_H
@@ -23,6 +23,15 @@
 #if !defined(fdatasync)
 #define fdatasync fsync
 #endif
+
+#define POSIX_FADV_NORMAL
+#define POSIX_FADV_SEQUENTIAL
+#define POSIX_FADV_RANDOM
+#define POSIX_FADV_NOREUSE
+#define POSIX_FADV_WILLNEED
+#define POSIX_FADV_DONTNEED
+
+#define posix_fadvise(fd, offset, len, advice) 0
 #endif // defined(PENV_OS_MACOSX)
 
 #define PENV_S1(x) #x
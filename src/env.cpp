@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <cerrno>
 #include <dirent.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <random>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -9,7 +12,9 @@
 
 #include "defs.h"
 #include "env.h"
+#include "extent_iterator.h"
 #include "mmap_file.h"
+#include "mmap_writable_file.h"
 #include "random_access_file.h"
 #include "sequential_file.h"
 #include "writable_file.h"
@@ -18,6 +23,9 @@
 
 namespace penv {
     class PosixEnv : public Env {
+    private:
+        MmapBudget budget_;
+
     public:
         ~PosixEnv() override = default;
 
@@ -27,18 +35,35 @@ namespace penv {
         }
 
         size_t GetFileSize(const std::string & fname) override {
+            size_t size;
+            Status s = TryGetFileSize(fname, &size);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+            return size;
+        }
+
+        Status TryGetFileSize(const std::string & fname, size_t * size) noexcept override {
             struct stat sbuf;
             if (stat(fname.c_str(), &sbuf) != 0) {
-                throw IO_EXCEPTION(fname);
-            } else {
-                return static_cast<size_t>(sbuf.st_size);
+                return PENV_STATUS(errno);
             }
+            *size = static_cast<size_t>(sbuf.st_size);
+            return Status();
         }
 
         void DeleteFile(const std::string & fname) override {
+            Status s = TryDeleteFile(fname);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+        }
+
+        Status TryDeleteFile(const std::string & fname) noexcept override {
             if (unlink(fname.c_str()) != 0) {
-                throw IO_EXCEPTION(fname);
+                return PENV_STATUS(errno);
             }
+            return Status();
         }
 
         // https://stackoverflow.com/questions/5467725/how-to-delete-a-directory-and-its-contents-in-posix-c
@@ -73,12 +98,35 @@ namespace penv {
         }
 
     public:
+        // 临时文件名的随机后缀
+        static std::string RandomSuffix() {
+            thread_local std::mt19937_64 rng(std::random_device{}() ^ static_cast<uint64_t>(getpid()));
+            static const char kDigits[] = "0123456789abcdef";
+            uint64_t v = rng();
+            std::string suffix(16, '0');
+            for (char & c : suffix) {
+                c = kDigits[v & 0xf];
+                v >>= 4;
+            }
+            return suffix;
+        }
+
         inline static void SetCLOEXEC(int fd) {
             fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
         }
 
         std::unique_ptr<SequentialFile>
         OpenSequentialFile(const std::string & fname) override {
+            std::unique_ptr<SequentialFile> result;
+            Status s = TryOpenSequentialFile(fname, &result);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+            return result;
+        }
+
+        Status TryOpenSequentialFile(const std::string & fname,
+                                     std::unique_ptr<SequentialFile> * result) noexcept override {
             int fd;
             int flags = O_RDONLY;
 
@@ -86,7 +134,7 @@ namespace penv {
                 fd = open(fname.c_str(), flags, kPermission);
             } while (fd < 0 && errno == EINTR);
             if (fd < 0) {
-                throw IO_EXCEPTION(fname);
+                return PENV_STATUS(errno);
             }
             SetCLOEXEC(fd);
 
@@ -95,14 +143,31 @@ namespace penv {
                 file = fdopen(fd, "r");
             } while (file == nullptr && errno == EINTR);
             if (file == nullptr) {
+                int code = errno;
                 close(fd);
-                throw IO_EXCEPTION(fname);
+                return PENV_STATUS(code);
             }
-            return std::make_unique<PosixSequentialFile>(fname, file);
+            try {
+                *result = std::make_unique<PosixSequentialFile>(fname, file);
+            } catch (const std::bad_alloc &) {
+                fclose(file);
+                return PENV_STATUS(ENOMEM);
+            }
+            return Status();
         }
 
         std::unique_ptr<RandomAccessFile>
-        OpenRandomAccessFie(const std::string & fname) override {
+        OpenRandomAccessFile(const std::string & fname) override {
+            std::unique_ptr<RandomAccessFile> result;
+            Status s = TryOpenRandomAccessFile(fname, &result);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+            return result;
+        }
+
+        Status TryOpenRandomAccessFile(const std::string & fname,
+                                       std::unique_ptr<RandomAccessFile> * result) noexcept override {
             int fd;
             int flags = O_RDONLY;
 
@@ -110,46 +175,183 @@ namespace penv {
                 fd = open(fname.c_str(), flags, kPermission);
             } while (fd < 0 && errno == EINTR);
             if (fd < 0) {
-                throw IO_EXCEPTION(fname);
+                return PENV_STATUS(errno);
             }
             SetCLOEXEC(fd);
-            return std::make_unique<PosixRandomAccessFile>(fname, fd);
+            try {
+                *result = std::make_unique<PosixRandomAccessFile>(fname, fd);
+            } catch (const std::bad_alloc &) {
+                close(fd);
+                return PENV_STATUS(ENOMEM);
+            }
+            return Status();
         }
 
-        static std::unique_ptr<WritableFile>
-        OpenWritableFile(const std::string & fname, bool reopen) {
+        Status TryOpenWritableFile(const std::string & fname, bool reopen,
+                                   std::unique_ptr<WritableFile> * result) noexcept {
             int fd;
             int flags;
-            size_t filesize;
+            size_t filesize = 0;
             if (reopen) {
                 flags = O_CREAT | O_WRONLY | O_APPEND;
-                filesize = Default()->GetFileSize(fname);
+                Status s = TryGetFileSize(fname, &filesize);
+                if (!s.ok()) {
+                    return s;
+                }
             } else {
                 flags = O_CREAT | O_WRONLY | O_TRUNC;
-                filesize = 0;
             }
 
             do {
                 fd = open(fname.c_str(), flags, kPermission);
             } while (fd < 0 && errno == EINTR);
             if (fd < 0) {
-                throw IO_EXCEPTION(fname);
+                return PENV_STATUS(errno);
             }
             SetCLOEXEC(fd);
-            return std::make_unique<PosixWritableFile>(fname, filesize, fd);
+            try {
+                *result = std::make_unique<PosixWritableFile>(fname, filesize, fd);
+            } catch (const std::bad_alloc &) {
+                close(fd);
+                return PENV_STATUS(ENOMEM);
+            }
+            return Status();
         }
 
         std::unique_ptr<WritableFile>
         OpenWritableFile(const std::string & fname) override {
-            return OpenWritableFile(fname, false);
+            std::unique_ptr<WritableFile> result;
+            Status s = TryOpenWritableFile(fname, false, &result);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+            return result;
+        }
+
+        Status TryOpenWritableFile(const std::string & fname,
+                                   std::unique_ptr<WritableFile> * result) noexcept override {
+            return TryOpenWritableFile(fname, false, result);
         }
 
         std::unique_ptr<WritableFile>
         ReopenWritableFile(const std::string & fname) override {
-            return OpenWritableFile(fname, true);
+            std::unique_ptr<WritableFile> result;
+            Status s = TryOpenWritableFile(fname, true, &result);
+            if (!s.ok()) {
+                throw s.ToException(fname);
+            }
+            return result;
+        }
+
+        std::unique_ptr<WritableFile>
+        OpenTempWritableFile(const std::string & dirname) override {
+            int fd = -1;
+#if defined(O_TMPFILE)
+            do {
+                fd = open(dirname.c_str(), O_TMPFILE | O_WRONLY, kPermission);
+            } while (fd < 0 && errno == EINTR);
+            if (fd >= 0) {
+                SetCLOEXEC(fd);
+                return std::make_unique<PosixWritableFile>(dirname, 0, fd, PosixWritableFile::kAnonymousTemp);
+            }
+            // 内核或文件系统不支持 O_TMPFILE
+            if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+                throw IO_EXCEPTION(dirname);
+            }
+#endif
+            // 不用 mkstemp: 它固定以 0600 创建, 而读取 umask 会短暂改动整个进程的 umask
+            // 自行生成文件名并以 O_EXCL 创建, 权限与 O_TMPFILE 路径一样由内核按 umask 处理
+            std::string fname;
+            for (int attempt = 0; attempt < 100 && fd < 0; ++attempt) {
+                fname = dirname + "/.penv-tmp-" + RandomSuffix();
+                do {
+                    fd = open(fname.c_str(), O_CREAT | O_EXCL | O_WRONLY, kPermission);
+                } while (fd < 0 && errno == EINTR);
+                if (fd < 0 && errno != EEXIST) {
+                    throw IO_EXCEPTION(fname);
+                }
+            }
+            if (fd < 0) {
+                throw IO_EXCEPTION(dirname);
+            }
+            SetCLOEXEC(fd);
+            return std::make_unique<PosixWritableFile>(fname, 0, fd, PosixWritableFile::kNamedTemp);
+        }
+
+        void PublishTempFile(WritableFile * file, const std::string & fname) override {
+            auto * posix_file = dynamic_cast<PosixWritableFile *>(file);
+            if (posix_file == nullptr) {
+                errno = EINVAL;
+                throw IO_EXCEPTION(fname);
+            }
+            posix_file->Publish(fname);
+        }
+
+        void SyncDir(const std::string & dirname) override {
+            int fd;
+            do {
+                fd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY);
+            } while (fd < 0 && errno == EINTR);
+            if (fd < 0) {
+                throw IO_EXCEPTION(dirname);
+            }
+            int r = fsync(fd);
+            close(fd);
+            if (r != 0) {
+                throw IO_EXCEPTION(dirname);
+            }
         }
 
-        static std::unique_ptr<MmapFile>
+        std::unique_ptr<WritableFile>
+        OpenMmapWritableFile(const std::string & fname, bool reopen) {
+            int fd;
+            int flags;
+            size_t filesize;
+            if (reopen) {
+                flags = O_CREAT | O_RDWR;
+                filesize = Default()->GetFileSize(fname);
+            } else {
+                flags = O_CREAT | O_RDWR | O_TRUNC;
+                filesize = 0;
+            }
+
+            do {
+                fd = open(fname.c_str(), flags, kPermission);
+            } while (fd < 0 && errno == EINTR);
+            if (fd < 0) {
+                throw IO_EXCEPTION(fname);
+            }
+            SetCLOEXEC(fd);
+
+            // 映射不能越过文件末尾, 不足 kMinSize 时先扩展, 析构时会截断回来
+            size_t len = std::max<size_t>(filesize, MmapFile::kMinSize);
+            if (filesize < len) {
+                int r = ftruncate(fd, static_cast<off_t>(len));
+                if (r != 0) {
+                    close(fd);
+                    throw IO_EXCEPTION(fname);
+                }
+            }
+
+            void * base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                close(fd);
+                throw IO_EXCEPTION(fname);
+            }
+            return std::make_unique<PosixMmapWritableFile>(fname, base, len, fd, filesize, &budget_);
+        }
+
+        std::unique_ptr<WritableFile>
+        OpenMmapWritableFile(const std::string & fname) override {
+            return OpenMmapWritableFile(fname, false);
+        }
+
+        std::unique_ptr<WritableFile>
+        ReopenMmapWritableFile(const std::string & fname) override {
+            return OpenMmapWritableFile(fname, true);
+        }
+
+        std::unique_ptr<MmapFile>
         OpenMmapFile(const std::string & fname, bool reopen) {
             int fd;
             int flags;
@@ -181,7 +383,7 @@ namespace penv {
             if (base == MAP_FAILED) {
                 throw IO_EXCEPTION(fname);
             }
-            return std::make_unique<PosixMmapFile>(fname, base, len, fd);
+            return std::make_unique<PosixMmapFile>(fname, base, len, fd, &budget_);
         }
 
         std::unique_ptr<MmapFile>
@@ -193,6 +395,34 @@ namespace penv {
         ReopenMmapFile(const std::string & fname) override {
             return OpenMmapFile(fname, true);
         }
+
+        std::unique_ptr<ExtentIterator>
+        NewExtentIterator(const std::string & fname) override {
+            int fd;
+            do {
+                fd = open(fname.c_str(), O_RDONLY, kPermission);
+            } while (fd < 0 && errno == EINTR);
+            if (fd < 0) {
+                throw IO_EXCEPTION(fname);
+            }
+            SetCLOEXEC(fd);
+
+            struct stat sbuf;
+            if (fstat(fd, &sbuf) != 0) {
+                close(fd);
+                throw IO_EXCEPTION(fname);
+            }
+            return std::make_unique<PosixExtentIterator>(fname, static_cast<size_t>(sbuf.st_size), fd);
+        }
+
+    public:
+        void SetMmapBudget(size_t budget, MmapBudgetPolicy policy) override {
+            budget_.SetBudget(budget, policy);
+        }
+
+        MmapBudgetStats GetMmapBudgetStats() override {
+            return budget_.GetStats();
+        }
     };
 
     Env * Env::Default() {
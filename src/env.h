@@ -19,14 +19,24 @@
  * 发布协议: AGPL
  *
  * 注意: 全组件使用 **异常** 替代 **状态码**
+ * 例外: 热路径上预期会失败的操作另有 noexcept 的 Try* 版本, 返回 Status, 仅限:
+ *   Env: TryGetFileSize, TryDeleteFile, TryOpenSequentialFile, TryOpenRandomAccessFile, TryOpenWritableFile
+ *   SequentialFile: TryRead
+ *   RandomAccessFile: TryReadAt
+ *   WritableFile: TryWrite, TrySync
+ * 其余接口(包括 MmapFile 与目录操作)只有抛异常的版本
  */
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "slice.h"
+#include "status.h"
 
 namespace penv {
+    class ExtentIterator;
+
     class MmapFile;
 
     class RandomAccessFile;
@@ -35,6 +45,17 @@ namespace penv {
 
     class WritableFile;
 
+    struct MmapBudgetStats {
+        size_t budget = 0;
+        // 全部映射的文件与字节数
+        size_t mapped_files = 0;
+        size_t mapped_bytes = 0;
+        // 映射文件驻留在 page cache 中的字节数, 预算针对这部分
+        size_t resident_bytes = 0;
+        // 累计回收次数
+        uint64_t advised = 0;
+    };
+
     class Env {
     public:
         Env() = default;
@@ -66,7 +87,14 @@ namespace penv {
         OpenSequentialFile(const std::string & fname) = 0;
 
         virtual std::unique_ptr<RandomAccessFile>
-        OpenRandomAccessFie(const std::string & fname) = 0;
+        OpenRandomAccessFile(const std::string & fname) = 0;
+
+        // 旧的拼写, 仅为兼容已有调用方保留
+        [[deprecated("use OpenRandomAccessFile")]]
+        std::unique_ptr<RandomAccessFile>
+        OpenRandomAccessFie(const std::string & fname) {
+            return OpenRandomAccessFile(fname);
+        }
 
         virtual std::unique_ptr<WritableFile>
         OpenWritableFile(const std::string & fname) = 0;
@@ -74,11 +102,74 @@ namespace penv {
         virtual std::unique_ptr<WritableFile>
         ReopenWritableFile(const std::string & fname) = 0;
 
+        // 基于 mmap 的追加写, 适合小记录高频写入
+        virtual std::unique_ptr<WritableFile>
+        OpenMmapWritableFile(const std::string & fname) = 0;
+
+        virtual std::unique_ptr<WritableFile>
+        ReopenMmapWritableFile(const std::string & fname) = 0;
+
+        // 在 dirname 下创建匿名临时文件(O_TMPFILE), 不支持时退化为带名临时文件
+        // 未发布即析构则文件消失
+        virtual std::unique_ptr<WritableFile>
+        OpenTempWritableFile(const std::string & dirname) = 0;
+
+        // file 须来自 OpenTempWritableFile; 同步数据后原子地发布为 fname, 已存在则覆盖
+        // 不同步目录, 一批文件发布完成后调用一次 SyncDir 即可持久化
+        virtual void PublishTempFile(WritableFile * file, const std::string & fname) = 0;
+
+        virtual void SyncDir(const std::string & dirname) = 0;
+
         virtual std::unique_ptr<MmapFile>
         OpenMmapFile(const std::string & fname) = 0;
 
         virtual std::unique_ptr<MmapFile>
         ReopenMmapFile(const std::string & fname) = 0;
+
+        // 按 SEEK_DATA/SEEK_HOLE 遍历文件的数据区与空洞
+        virtual std::unique_ptr<ExtentIterator>
+        NewExtentIterator(const std::string & fname) = 0;
+
+    public:
+        // 驻留量超出预算时按最近最少访问回收 MmapFile 及 mmap 写文件的内存
+        // 映射本身保留, Base() 指针始终有效, 再次访问时按页重新缺页载入
+        enum MmapBudgetPolicy {
+            // MADV_COLD, 不立即释放, 内存紧张时内核优先回收
+            kMmapAdviseCold,
+            // MADV_DONTNEED 解除页表并逐出干净页
+            kMmapAdviseDontNeed
+        };
+
+        // budget == 0 表示不限制
+        virtual void SetMmapBudget(size_t budget, MmapBudgetPolicy policy) = 0;
+
+        virtual MmapBudgetStats GetMmapBudgetStats() = 0;
+
+    public:
+        // 以下默认实现包装抛异常的版本, 只省去调用方的 try/catch; PosixEnv 直接实现
+
+        virtual Status TryGetFileSize(const std::string & fname, size_t * size) noexcept {
+            return PENV_CATCH_STATUS([&] { *size = GetFileSize(fname); });
+        }
+
+        virtual Status TryDeleteFile(const std::string & fname) noexcept {
+            return PENV_CATCH_STATUS([&] { DeleteFile(fname); });
+        }
+
+        virtual Status TryOpenSequentialFile(const std::string & fname,
+                                             std::unique_ptr<SequentialFile> * result) noexcept {
+            return PENV_CATCH_STATUS([&] { *result = OpenSequentialFile(fname); });
+        }
+
+        virtual Status TryOpenRandomAccessFile(const std::string & fname,
+                                               std::unique_ptr<RandomAccessFile> * result) noexcept {
+            return PENV_CATCH_STATUS([&] { *result = OpenRandomAccessFile(fname); });
+        }
+
+        virtual Status TryOpenWritableFile(const std::string & fname,
+                                           std::unique_ptr<WritableFile> * result) noexcept {
+            return PENV_CATCH_STATUS([&] { *result = OpenWritableFile(fname); });
+        }
     };
 
     class SequentialFile {
@@ -91,6 +182,12 @@ namespace penv {
         virtual void Read(size_t n, char * scratch) = 0;
 
         virtual void Skip(size_t n) = 0;
+
+        // *bytes_read < n 表示读到末尾; 默认实现无法得知实际字节数, 记为 n
+        virtual Status TryRead(size_t n, char * scratch, size_t * bytes_read) noexcept {
+            *bytes_read = n;
+            return PENV_CATCH_STATUS([&] { Read(n, scratch); });
+        }
     };
 
     class RandomAccessFile {
@@ -104,11 +201,35 @@ namespace penv {
 
         virtual void Prefetch(size_t offset, size_t n) = 0;
 
+        // ADAPTIVE: 跟踪 ReadAt 的偏移, 检测到顺序读时自动预读, 窗口随之伸缩
         enum AccessPattern {
-            NORMAL, SEQUENTIAL, RANDOM, NOREUSE, WILLNEED, DONTNEED
+            NORMAL, SEQUENTIAL, RANDOM, NOREUSE, WILLNEED, DONTNEED, ADAPTIVE
         };
 
         virtual void Hint(AccessPattern hint) = 0;
+
+        // 以下 n == 0 表示直到文件末尾
+
+        // ADAPTIVE 作用于整个文件, 等同 Hint(ADAPTIVE)
+        virtual void RangeHint(size_t offset, size_t n, AccessPattern hint) = 0;
+
+        // 返回驻留在 page cache 中的字节数(按页计)
+        virtual size_t GetResidentSize(size_t offset, size_t n) const = 0;
+
+        // 驻留区间 (offset, length), 按页对齐
+        virtual void GetResidentRanges(size_t offset, size_t n,
+                                       std::vector<std::pair<size_t, size_t>> * result) const = 0;
+
+        // 返回 >= offset 的下一个数据区起点, 没有则返回文件大小
+        virtual size_t SeekData(size_t offset) const = 0;
+
+        // 返回 >= offset 的下一个空洞起点, 文件末尾视为空洞
+        virtual size_t SeekHole(size_t offset) const = 0;
+
+        // 读不满 n 字节时返回 IsEndOfFile()
+        virtual Status TryReadAt(size_t offset, size_t n, char * scratch) const noexcept {
+            return PENV_CATCH_STATUS([&] { ReadAt(offset, n, scratch); });
+        }
     };
 
     class WritableFile {
@@ -143,6 +264,46 @@ namespace penv {
         virtual void PrepareWrite(size_t offset, size_t n) = 0;
 
         virtual void Allocate(size_t offset, size_t n) = 0;
+
+        // 以下依赖文件系统支持, offset 与 n 通常需按块对齐
+
+        // 释放空间, 文件大小不变, 读出为零
+        virtual void PunchHole(size_t offset, size_t n) = 0;
+
+        // 移除区间, 之后的数据前移, 文件变小
+        virtual void CollapseRange(size_t offset, size_t n) = 0;
+
+        // 插入空洞, 之后的数据后移, 文件变大
+        virtual void InsertRange(size_t offset, size_t n) = 0;
+
+        // 区间置零并保留分配, 文件大小不变
+        virtual void ZeroRange(size_t offset, size_t n) = 0;
+
+        virtual Status TryWrite(const Slice & data) noexcept {
+            return PENV_CATCH_STATUS([&] { Write(data); });
+        }
+
+        virtual Status TrySync() noexcept {
+            return PENV_CATCH_STATUS([&] { Sync(); });
+        }
+    };
+
+    class ExtentIterator {
+    public:
+        ExtentIterator() = default;
+
+        virtual ~ExtentIterator() = default;
+
+    public:
+        virtual bool Valid() const = 0;
+
+        virtual void Next() = 0;
+
+        virtual size_t offset() const = 0;
+
+        virtual size_t size() const = 0;
+
+        virtual bool IsHole() const = 0;
     };
 
     class MmapFile {
@@ -156,6 +317,9 @@ namespace penv {
 
         virtual const void * Base() const = 0;
 
+        // 声明一次访问, 缓存 Base() 指针的使用者在每次操作时调用, 供映射内存预算判断访问顺序
+        virtual void Touch() const {}
+
         enum {
             kMinSize = 4096
         };
@@ -171,6 +335,16 @@ namespace penv {
         };
 
         virtual void Hint(AccessPattern hint) = 0;
+
+        // 以下 n == 0 表示直到映射末尾
+        // DONTNEED 同时将干净页逐出 page cache, 脏页需先 Sync
+
+        virtual void RangeHint(size_t offset, size_t n, AccessPattern hint) = 0;
+
+        virtual size_t GetResidentSize(size_t offset, size_t n) const = 0;
+
+        virtual void GetResidentRanges(size_t offset, size_t n,
+                                       std::vector<std::pair<size_t, size_t>> * result) const = 0;
     };
 }
 
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "defs.h"
+#include "extent_iterator.h"
+
+#define IO_EXCEPTION(f) std::runtime_error("IO:" + PENV_EXCEPTION_INFO + " | " + strerror(errno) + " | " + (f))
+
+namespace penv {
+    PosixExtentIterator::PosixExtentIterator(std::string fname, size_t filesize, int fd)
+            : fname_(std::move(fname)),
+              filesize_(filesize),
+              offset_(0),
+              end_(0),
+              hole_(false),
+              fd_(fd) {
+        Locate(0);
+    }
+
+    PosixExtentIterator::~PosixExtentIterator() {
+        close(fd_);
+    }
+
+    void PosixExtentIterator::Next() {
+        assert(Valid());
+        Locate(end_);
+    }
+
+    void PosixExtentIterator::Locate(size_t offset) {
+        offset_ = offset;
+        if (offset_ >= filesize_) {
+            offset_ = end_ = filesize_;
+            return;
+        }
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t data = lseek(fd_, static_cast<off_t>(offset_), SEEK_DATA);
+        if (data < 0) {
+            if (errno != ENXIO) {
+                throw IO_EXCEPTION(fname_);
+            }
+            // offset 之后全是空洞
+            data = static_cast<off_t>(filesize_);
+        }
+        if (static_cast<size_t>(data) > offset_) {
+            hole_ = true;
+            end_ = std::min(static_cast<size_t>(data), filesize_);
+            return;
+        }
+        off_t hole = lseek(fd_, static_cast<off_t>(offset_), SEEK_HOLE);
+        if (hole < 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        hole_ = false;
+        end_ = std::min(static_cast<size_t>(hole), filesize_);
+#else
+        hole_ = false;
+        end_ = filesize_;
+#endif
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef POSIX_ENV_EXTENT_ITERATOR_H
+#define POSIX_ENV_EXTENT_ITERATOR_H
+
+#include "env.h"
+
+namespace penv {
+    class PosixExtentIterator : public ExtentIterator {
+    private:
+        std::string fname_;
+        size_t filesize_;
+        size_t offset_;
+        size_t end_;
+        bool hole_;
+        int fd_;
+
+    public:
+        PosixExtentIterator(std::string fname, size_t filesize, int fd);
+
+        ~PosixExtentIterator() override;
+
+    public:
+        bool Valid() const override {
+            return offset_ < filesize_;
+        }
+
+        void Next() override;
+
+        size_t offset() const override {
+            return offset_;
+        }
+
+        size_t size() const override {
+            return end_ - offset_;
+        }
+
+        bool IsHole() const override {
+            return hole_;
+        }
+
+    private:
+        void Locate(size_t offset);
+    };
+}
+
+#endif //POSIX_ENV_EXTENT_ITERATOR_H
@@ -0,0 +1,330 @@
+#include <stdexcept>
+
+#include "coding.h"
+#include "defs.h"
+#include "external_sort.h"
+
+#define SORT_EXCEPTION(msg) std::runtime_error("Sort:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr size_t kLengthSize = sizeof(uint32_t);
+
+        // SequentialFile 之上的大块缓冲读, 需事先知道文件大小
+        class BufferedReader {
+        private:
+            std::unique_ptr<SequentialFile> file_;
+            std::string buffer_;
+            size_t pos_;
+            size_t end_;
+            size_t remaining_;
+
+        public:
+            BufferedReader(std::unique_ptr<SequentialFile> file, size_t file_size, size_t buffer_size)
+                    : file_(std::move(file)),
+                      buffer_(buffer_size, '\0'),
+                      pos_(0),
+                      end_(0),
+                      remaining_(file_size) {}
+
+        public:
+            bool Eof() const {
+                return pos_ == end_ && remaining_ == 0;
+            }
+
+            // result 指向内部缓冲或 scratch, 下次读取前有效
+            void Read(size_t n, Slice * result, std::string * scratch) {
+                if (end_ - pos_ >= n) {
+                    *result = Slice(buffer_.data() + pos_, n);
+                    pos_ += n;
+                    return;
+                }
+                scratch->assign(buffer_.data() + pos_, end_ - pos_);
+                pos_ = end_;
+                while (scratch->size() < n) {
+                    Refill();
+                    size_t take = std::min(n - scratch->size(), end_ - pos_);
+                    scratch->append(buffer_.data() + pos_, take);
+                    pos_ += take;
+                }
+                *result = *scratch;
+            }
+
+            bool ReadRecord(Slice * record, std::string * scratch) {
+                if (Eof()) {
+                    return false;
+                }
+                Slice header;
+                Read(kLengthSize, &header, scratch);
+                uint32_t len = DecodeFixed32(header.data());
+                Read(len, record, scratch);
+                return true;
+            }
+
+        private:
+            void Refill() {
+                if (remaining_ == 0) {
+                    throw SORT_EXCEPTION("truncated record");
+                }
+                size_t n = std::min(buffer_.size(), remaining_);
+                file_->Read(n, &buffer_[0]);
+                remaining_ -= n;
+                pos_ = 0;
+                end_ = n;
+            }
+        };
+
+        class BufferedWriter {
+        private:
+            std::unique_ptr<WritableFile> file_;
+            std::string buffer_;
+            size_t buffer_size_;
+
+        public:
+            BufferedWriter(std::unique_ptr<WritableFile> file, size_t buffer_size)
+                    : file_(std::move(file)),
+                      buffer_size_(buffer_size) {
+                buffer_.reserve(buffer_size);
+            }
+
+        public:
+            void WriteRecord(const Slice & record) {
+                PutFixed32(&buffer_, static_cast<uint32_t>(record.size()));
+                buffer_.append(record.data(), record.size());
+                if (buffer_.size() >= buffer_size_) {
+                    file_->Write(buffer_);
+                    buffer_.clear();
+                }
+            }
+
+            void Finish() {
+                if (!buffer_.empty()) {
+                    file_->Write(buffer_);
+                    buffer_.clear();
+                }
+                file_->Sync();
+            }
+        };
+
+        // 分段并行排序, 再逐轮两两并行归并
+        void ParallelSort(std::vector<Slice> * records, size_t threads) {
+            SliceComparator cmp;
+            size_t n = records->size();
+            threads = std::max<size_t>(1, std::min(threads, n / 4096 + 1));
+            if (threads == 1) {
+                std::sort(records->begin(), records->end(), cmp);
+                return;
+            }
+
+            std::vector<size_t> bounds;
+            for (size_t i = 0; i <= threads; ++i) {
+                bounds.emplace_back(n * i / threads);
+            }
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < threads; ++i) {
+                workers.emplace_back([records, &bounds, &cmp, i]() {
+                    std::sort(records->begin() + bounds[i], records->begin() + bounds[i + 1], cmp);
+                });
+            }
+            for (auto & worker : workers) {
+                worker.join();
+            }
+
+            std::vector<Slice> aux(n);
+            std::vector<Slice> * src = records;
+            std::vector<Slice> * dst = &aux;
+            while (bounds.size() > 2) {
+                std::vector<size_t> next_bounds;
+                workers.clear();
+                for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+                    size_t lo = bounds[i];
+                    size_t mid = bounds[i + 1];
+                    size_t hi = i + 2 < bounds.size() ? bounds[i + 2] : mid;
+                    workers.emplace_back([src, dst, &cmp, lo, mid, hi]() {
+                        std::merge(src->begin() + lo, src->begin() + mid,
+                                   src->begin() + mid, src->begin() + hi,
+                                   dst->begin() + lo, cmp);
+                    });
+                    next_bounds.emplace_back(lo);
+                }
+                next_bounds.emplace_back(n);
+                for (auto & worker : workers) {
+                    worker.join();
+                }
+                std::swap(src, dst);
+                bounds.swap(next_bounds);
+            }
+            if (src != records) {
+                records->swap(aux);
+            }
+        }
+
+        // 败者树, tree_[0] 为当前胜者; 编号 k 为虚拟的最小选手, 仅用于建树
+        class LoserTree {
+        private:
+            std::vector<BufferedReader *> readers_;
+            std::vector<Slice> keys_;
+            std::vector<bool> exhausted_;
+            std::vector<std::string> scratches_;
+            std::vector<size_t> tree_;
+            size_t k_;
+
+        public:
+            explicit LoserTree(std::vector<BufferedReader *> readers)
+                    : readers_(std::move(readers)),
+                      keys_(readers_.size()),
+                      exhausted_(readers_.size()),
+                      scratches_(readers_.size()),
+                      tree_(readers_.size(), readers_.size()),
+                      k_(readers_.size()) {
+                for (size_t i = 0; i < k_; ++i) {
+                    exhausted_[i] = !readers_[i]->ReadRecord(&keys_[i], &scratches_[i]);
+                }
+                for (size_t i = k_; i-- > 0;) {
+                    Adjust(i);
+                }
+            }
+
+        public:
+            bool Valid() const {
+                return k_ != 0 && !exhausted_[tree_[0]];
+            }
+
+            Slice Top() const {
+                return keys_[tree_[0]];
+            }
+
+            void Pop() {
+                size_t winner = tree_[0];
+                exhausted_[winner] = !readers_[winner]->ReadRecord(&keys_[winner], &scratches_[winner]);
+                Adjust(winner);
+            }
+
+        private:
+            // a 是否胜过 b, 相等时编号小者胜以保持稳定
+            bool Beats(size_t a, size_t b) const {
+                if (a == k_ || b == k_) {
+                    return a == k_;
+                }
+                if (exhausted_[a] || exhausted_[b]) {
+                    return !exhausted_[a];
+                }
+                int r = SliceCmp(keys_[a], keys_[b]);
+                return r < 0 || (r == 0 && a < b);
+            }
+
+            void Adjust(size_t s) {
+                for (size_t t = (s + k_) / 2; t > 0; t /= 2) {
+                    if (Beats(tree_[t], s)) {
+                        std::swap(s, tree_[t]);
+                    }
+                }
+                tree_[0] = s;
+            }
+        };
+    }
+
+    ExternalSorter::ExternalSorter(Env * env, const ExternalSortOptions & options)
+            : env_(env),
+              options_(options) {
+        if (options_.max_merge_width < 2) {
+            options_.max_merge_width = 2;
+        }
+        if (options_.run_prefix.empty()) {
+            options_.run_prefix = ".run.";
+        }
+    }
+
+    void ExternalSorter::Sort(const std::string & input, const std::string & output) {
+        stats_ = ExternalSortStats();
+        std::vector<std::string> runs;
+        GenerateRuns(input, output, &runs);
+        stats_.runs = runs.size();
+
+        size_t next_run = runs.size();
+        while (runs.size() > options_.max_merge_width) {
+            std::vector<std::string> merged;
+            for (size_t i = 0; i < runs.size(); i += options_.max_merge_width) {
+                std::vector<std::string> group(runs.begin() + i,
+                                               runs.begin() + std::min(runs.size(), i + options_.max_merge_width));
+                merged.emplace_back(output + options_.run_prefix + std::to_string(next_run++));
+                Merge(group, merged.back());
+                for (const auto & run : group) {
+                    env_->DeleteFile(run);
+                }
+            }
+            runs.swap(merged);
+            ++stats_.merge_passes;
+        }
+        Merge(runs, output);
+        ++stats_.merge_passes;
+        for (const auto & run : runs) {
+            env_->DeleteFile(run);
+        }
+    }
+
+    void ExternalSorter::GenerateRuns(const std::string & input, const std::string & output,
+                                      std::vector<std::string> * runs) {
+        BufferedReader reader(env_->OpenSequentialFile(input), env_->GetFileSize(input),
+                              options_.read_buffer_size);
+        std::string arena;
+        std::vector<std::pair<size_t, size_t>> locations;
+        std::vector<Slice> records;
+        std::string scratch;
+        arena.reserve(options_.memory_budget);
+
+        auto spill = [&]() {
+            records.clear();
+            for (const auto & location : locations) {
+                records.emplace_back(arena.data() + location.first, location.second);
+            }
+            ParallelSort(&records, options_.threads);
+
+            runs->emplace_back(output + options_.run_prefix + std::to_string(runs->size()));
+            BufferedWriter writer(env_->OpenWritableFile(runs->back()), options_.write_buffer_size);
+            for (const auto & record : records) {
+                writer.WriteRecord(record);
+            }
+            writer.Finish();
+            arena.clear();
+            locations.clear();
+        };
+
+        Slice record;
+        while (reader.ReadRecord(&record, &scratch)) {
+            // 记录本身加上 locations 与 records 中的索引开销
+            size_t charge = record.size() + sizeof(locations[0]) + sizeof(Slice);
+            if (charge > options_.memory_budget) {
+                throw SORT_EXCEPTION("record larger than memory budget: " + std::to_string(record.size()));
+            }
+            if (arena.size() + (locations.size() + 1) * (sizeof(locations[0]) + sizeof(Slice)) + record.size() >
+                options_.memory_budget) {
+                spill();
+            }
+            locations.emplace_back(arena.size(), record.size());
+            arena.append(record.data(), record.size());
+            ++stats_.records;
+            stats_.bytes += record.size();
+        }
+        if (!locations.empty()) {
+            spill();
+        }
+    }
+
+    void ExternalSorter::Merge(const std::vector<std::string> & runs, const std::string & output) {
+        std::vector<std::unique_ptr<BufferedReader>> readers;
+        std::vector<BufferedReader *> sources;
+        for (const auto & run : runs) {
+            readers.emplace_back(std::make_unique<BufferedReader>(env_->OpenSequentialFile(run),
+                                                                  env_->GetFileSize(run),
+                                                                  options_.read_buffer_size));
+            sources.emplace_back(readers.back().get());
+        }
+
+        BufferedWriter writer(env_->OpenWritableFile(output), options_.write_buffer_size);
+        for (LoserTree tree(sources); tree.Valid(); tree.Pop()) {
+            writer.WriteRecord(tree.Top());
+        }
+        writer.Finish();
+    }
+}
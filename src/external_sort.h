@@ -0,0 +1,63 @@
+#pragma once
+#ifndef POSIX_ENV_EXTERNAL_SORT_H
+#define POSIX_ENV_EXTERNAL_SORT_H
+
+/*
+ * 外部归并排序
+ *
+ * 输入输出均为长度前缀记录: [fixed32 长度][数据]
+ * 按 SliceComparator 对整条记录排序
+ * 1. 在内存预算内读入记录, 多线程排序后写成有序 run
+ * 2. 用败者树对 run 做 k 路归并, 每个 run 使用大块缓冲顺序读
+ *    run 数超过 max_merge_width 时先做中间归并
+ */
+
+#include <algorithm>
+#include <thread>
+
+#include "env.h"
+
+namespace penv {
+    struct ExternalSortOptions {
+        size_t memory_budget = 256 * 1024 * 1024;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        // 读输入及归并阶段每个 run 的读缓冲
+        size_t read_buffer_size = 1024 * 1024;
+        size_t write_buffer_size = 4 * 1024 * 1024;
+        size_t max_merge_width = 256;
+        // run 文件名为 output + run_prefix + 序号, 为空时取 ".run."
+        std::string run_prefix;
+    };
+
+    struct ExternalSortStats {
+        size_t records = 0;
+        size_t bytes = 0;
+        size_t runs = 0;
+        size_t merge_passes = 0;
+    };
+
+    class ExternalSorter {
+    private:
+        Env * env_;
+        ExternalSortOptions options_;
+        ExternalSortStats stats_;
+
+    public:
+        ExternalSorter(Env * env, const ExternalSortOptions & options = ExternalSortOptions());
+
+    public:
+        void Sort(const std::string & input, const std::string & output);
+
+        const ExternalSortStats & GetStats() const {
+            return stats_;
+        }
+
+    private:
+        void GenerateRuns(const std::string & input, const std::string & output,
+                          std::vector<std::string> * runs);
+
+        void Merge(const std::vector<std::string> & runs, const std::string & output);
+    };
+}
+
+#endif //POSIX_ENV_EXTERNAL_SORT_H
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef POSIX_ENV_HASH_H
+#define POSIX_ENV_HASH_H
+
+/*
+ * 落盘结构使用的哈希, 跨进程/跨版本结果稳定
+ * 算法为 MurmurHash64A
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "slice.h"
+
+namespace penv {
+    inline uint64_t Hash64(const char * data, size_t n, uint64_t seed = 0xc70f6907) {
+        constexpr uint64_t m = 0xc6a4a7935bd1e995ULL;
+        constexpr int r = 47;
+
+        uint64_t h = seed ^ (n * m);
+        const char * end = data + (n & ~size_t(7));
+        for (const char * p = data; p != end; p += 8) {
+            uint64_t k;
+            memcpy(&k, p, sizeof(k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        auto tail = reinterpret_cast<const uint8_t *>(end);
+        switch (n & 7) {
+            case 7:
+                h ^= uint64_t(tail[6]) << 48;
+                [[fallthrough]];
+            case 6:
+                h ^= uint64_t(tail[5]) << 40;
+                [[fallthrough]];
+            case 5:
+                h ^= uint64_t(tail[4]) << 32;
+                [[fallthrough]];
+            case 4:
+                h ^= uint64_t(tail[3]) << 24;
+                [[fallthrough]];
+            case 3:
+                h ^= uint64_t(tail[2]) << 16;
+                [[fallthrough]];
+            case 2:
+                h ^= uint64_t(tail[1]) << 8;
+                [[fallthrough]];
+            case 1:
+                h ^= uint64_t(tail[0]);
+                h *= m;
+                break;
+            default:
+                break;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+    inline uint64_t Hash64(const Slice & s) {
+        return Hash64(s.data(), s.size());
+    }
+}
+
+#endif //POSIX_ENV_HASH_H
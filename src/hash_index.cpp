@@ -0,0 +1,266 @@
+#include <stdexcept>
+#include <sys/mman.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "defs.h"
+#include "hash.h"
+#include "hash_index.h"
+#include "page_cache.h"
+
+#define INDEX_EXCEPTION(msg) std::runtime_error("HashIndex:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr uint64_t kIndexMagic = 0x31584948564e4550; // "PENVHIX1"
+
+        constexpr uint8_t kEmpty = 0;
+        constexpr uint8_t kDeleted = 1;
+
+        // 每次写操作迁移的旧桶数
+        constexpr size_t kMigrateBuckets = 4;
+
+        // tag 取哈希高 7 位并置最高位, 与 kEmpty/kDeleted 区分; 桶号取低位
+        inline uint8_t TagOf(uint64_t hash) {
+            return static_cast<uint8_t>(0x80 | (hash >> 57));
+        }
+
+        // 返回 16 个 tag 中等于 b 的位图
+        inline uint32_t MatchByte(const uint8_t * tags, uint8_t b) {
+#if defined(__SSE2__)
+            __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i *>(tags));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(b)))));
+#else
+            uint32_t mask = 0;
+            for (int i = 0; i < PersistentHashIndex::kSlotsPerBucket; ++i) {
+                mask |= static_cast<uint32_t>(tags[i] == b) << i;
+            }
+            return mask;
+#endif
+        }
+
+        inline size_t RoundUp(size_t n, size_t align) {
+            return (n + align - 1) / align * align;
+        }
+    }
+
+    void PersistentHashIndex::Init(MmapFile * file, const HashIndexOptions & options) {
+        if (options.key_capacity == 0 || options.key_capacity > 255) {
+            throw INDEX_EXCEPTION("key_capacity must be in [1, 255]");
+        }
+        size_t buckets = 1;
+        while (buckets < options.initial_buckets) {
+            buckets <<= 1;
+        }
+        size_t slot_size = RoundUp(options.key_capacity, sizeof(uint64_t)) + sizeof(uint64_t);
+        size_t bucket_size = RoundUp(kCacheLineSize + kSlotsPerBucket * slot_size, kCacheLineSize);
+        size_t file_end = kHeaderSize + RoundUp(buckets * bucket_size, PageSize());
+
+        file->Resize(file_end);
+        memset(file->Base(), 0, file_end);
+        auto * header = static_cast<Header *>(file->Base());
+        header->key_capacity = options.key_capacity;
+        header->slot_size = slot_size;
+        header->bucket_size = bucket_size;
+        header->count = 0;
+        header->file_end = file_end;
+        header->tables[0] = {kHeaderSize, buckets, 0};
+        header->tables[1] = {0, 0, 0};
+        header->migrate_cursor = 0;
+        header->magic = kIndexMagic;
+    }
+
+    PersistentHashIndex::PersistentHashIndex(MmapFile * file)
+            : file_(file),
+              base_(static_cast<char *>(file->Base())) {
+        static_assert(sizeof(Header) <= kHeaderSize);
+        if (file->GetFileSize() < kHeaderSize || header()->magic != kIndexMagic) {
+            throw INDEX_EXCEPTION("bad magic");
+        }
+        if (file->GetFileSize() < header()->file_end) {
+            throw INDEX_EXCEPTION("file too small");
+        }
+    }
+
+    bool PersistentHashIndex::Get(const Slice & key, uint64_t * value) const {
+        file_->Touch();
+        uint64_t hash = Hash64(key);
+        char * slot = Find(header()->tables[0], key, hash);
+        if (slot == nullptr && Migrating()) {
+            slot = Find(header()->tables[1], key, hash);
+        }
+        if (slot == nullptr) {
+            return false;
+        }
+        memcpy(value, slot + header()->slot_size - sizeof(uint64_t), sizeof(uint64_t));
+        return true;
+    }
+
+    void PersistentHashIndex::Put(const Slice & key, uint64_t value) {
+        file_->Touch();
+        if (key.size() > header()->key_capacity) {
+            throw INDEX_EXCEPTION("key too long: " + std::to_string(key.size()));
+        }
+        if (Migrating()) {
+            MigrateStep(kMigrateBuckets);
+        }
+
+        uint64_t hash = Hash64(key);
+        char * slot = Find(header()->tables[0], key, hash);
+        if (slot != nullptr) {
+            memcpy(slot + header()->slot_size - sizeof(uint64_t), &value, sizeof(value));
+            return;
+        }
+        // 旧表中的同名 key 先删除, 再插入新表
+        if (Migrating() && EraseFrom(&header()->tables[1], key, hash)) {
+            --header()->count;
+        }
+
+        // 装载率(含删除标记)超过 7/8 时扩容
+        const Table & current = header()->tables[0];
+        if ((current.used + 1) * 8 > current.buckets * kSlotsPerBucket * 7) {
+            StartResize();
+        }
+        InsertNew(&header()->tables[0], key, hash, value);
+        ++header()->count;
+    }
+
+    bool PersistentHashIndex::Delete(const Slice & key) {
+        file_->Touch();
+        if (Migrating()) {
+            MigrateStep(kMigrateBuckets);
+        }
+        uint64_t hash = Hash64(key);
+        bool found = EraseFrom(&header()->tables[0], key, hash) ||
+                     (Migrating() && EraseFrom(&header()->tables[1], key, hash));
+        if (found) {
+            --header()->count;
+        }
+        return found;
+    }
+
+    char * PersistentHashIndex::Find(const Table & table, const Slice & key, uint64_t hash,
+                                     char ** bucket_out, size_t * slot_out) const {
+        if (table.buckets == 0) {
+            return nullptr;
+        }
+        const size_t slot_size = header()->slot_size;
+        const uint8_t tag = TagOf(hash);
+        const uint64_t mask = table.buckets - 1;
+        uint64_t index = hash & mask;
+        for (uint64_t probes = 0; probes < table.buckets; ++probes, index = (index + 1) & mask) {
+            char * bucket = Bucket(table, index);
+            auto * tags = reinterpret_cast<const uint8_t *>(bucket);
+            const uint8_t * sizes = tags + kSlotsPerBucket;
+            for (uint32_t match = MatchByte(tags, tag); match != 0; match &= match - 1) {
+                auto i = static_cast<size_t>(__builtin_ctz(match));
+                char * slot = bucket + kCacheLineSize + i * slot_size;
+                if (sizes[i] == key.size() && memcmp(slot, key.data(), key.size()) == 0) {
+                    if (bucket_out != nullptr) {
+                        *bucket_out = bucket;
+                        *slot_out = i;
+                    }
+                    return slot;
+                }
+            }
+            // 桶内有空槽说明探测链到此为止
+            if (MatchByte(tags, kEmpty) != 0) {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    bool PersistentHashIndex::EraseFrom(Table * table, const Slice & key, uint64_t hash) {
+        char * bucket;
+        size_t i;
+        if (Find(*table, key, hash, &bucket, &i) == nullptr) {
+            return false;
+        }
+        reinterpret_cast<uint8_t *>(bucket)[i] = kDeleted;
+        return true;
+    }
+
+    void PersistentHashIndex::InsertNew(Table * table, const Slice & key, uint64_t hash, uint64_t value) {
+        const size_t slot_size = header()->slot_size;
+        const uint64_t mask = table->buckets - 1;
+        uint64_t index = hash & mask;
+        for (uint64_t probes = 0; probes < table->buckets; ++probes, index = (index + 1) & mask) {
+            char * bucket = Bucket(*table, index);
+            auto * tags = reinterpret_cast<uint8_t *>(bucket);
+            uint32_t match = MatchByte(tags, kEmpty) | MatchByte(tags, kDeleted);
+            if (match == 0) {
+                continue;
+            }
+            auto i = static_cast<size_t>(__builtin_ctz(match));
+            char * slot = bucket + kCacheLineSize + i * slot_size;
+            memcpy(slot, key.data(), key.size());
+            memcpy(slot + slot_size - sizeof(uint64_t), &value, sizeof(value));
+            tags[kSlotsPerBucket + i] = static_cast<uint8_t>(key.size());
+            if (tags[i] == kEmpty) {
+                ++table->used;
+            }
+            // tag 最后写入
+            tags[i] = TagOf(hash);
+            return;
+        }
+        throw INDEX_EXCEPTION("table full");
+    }
+
+    void PersistentHashIndex::StartResize() {
+        if (Migrating()) {
+            MigrateStep(SIZE_MAX);
+        }
+
+        // 删除标记较多时原尺寸重建即可, 否则翻倍, 目标装载率不超过 7/16
+        Header * hd = header();
+        uint64_t buckets = hd->tables[0].buckets;
+        while ((hd->count + 1) * 16 > buckets * kSlotsPerBucket * 7) {
+            buckets <<= 1;
+        }
+        uint64_t offset = hd->file_end;
+        uint64_t file_end = offset + RoundUp(buckets * hd->bucket_size, PageSize());
+
+        file_->Resize(file_end);
+        base_ = static_cast<char *>(file_->Base());
+        hd = header();
+        memset(base_ + offset, 0, file_end - offset);
+        hd->tables[1] = hd->tables[0];
+        hd->tables[0] = {offset, buckets, 0};
+        hd->migrate_cursor = 0;
+        hd->file_end = file_end;
+    }
+
+    void PersistentHashIndex::MigrateStep(size_t buckets) {
+        Header * hd = header();
+        Table & old = hd->tables[1];
+        const size_t slot_size = hd->slot_size;
+        for (; buckets != 0 && hd->migrate_cursor < old.buckets; --buckets, ++hd->migrate_cursor) {
+            char * bucket = Bucket(old, hd->migrate_cursor);
+            auto * tags = reinterpret_cast<uint8_t *>(bucket);
+            for (size_t i = 0; i < kSlotsPerBucket; ++i) {
+                if ((tags[i] & 0x80) == 0) {
+                    continue;
+                }
+                char * slot = bucket + kCacheLineSize + i * slot_size;
+                Slice key(slot, tags[kSlotsPerBucket + i]);
+                uint64_t value;
+                memcpy(&value, slot + slot_size - sizeof(uint64_t), sizeof(value));
+                InsertNew(&hd->tables[0], key, Hash64(key), value);
+                // 标记为删除而非置空, 以免截断旧表中跨桶的探测链
+                tags[i] = kDeleted;
+            }
+        }
+
+        if (hd->migrate_cursor == old.buckets) {
+            // 旧表不再使用, 释放其磁盘空间
+#if defined(MADV_REMOVE)
+            madvise(base_ + old.offset, RoundUp(old.buckets * hd->bucket_size, PageSize()), MADV_REMOVE);
+#endif
+            old = {0, 0, 0};
+            hd->migrate_cursor = 0;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#ifndef POSIX_ENV_HASH_INDEX_H
+#define POSIX_ENV_HASH_INDEX_H
+
+/*
+ * 存储在 MmapFile 中的持久化开放寻址哈希索引
+ * Slice key -> uint64_t value(例如 value log 中的偏移)
+ *
+ * 文件布局: [header 页][哈希表]...
+ * 每个桶为一条 64 字节控制行(16 个 tag + 16 个 key 长度)加 16 个定长槽
+ * 桶按缓存行对齐, 查找时用 SIMD 一次比较 16 个 tag, 桶满则线性探测下一个桶
+ *
+ * 扩容为渐进式: 新表追加在文件末尾(Resize), 之后每次写操作迁移少量旧桶,
+ * 迁移完成后释放旧表占用的磁盘空间
+ * 重新打开时直接使用映射, 无需重建
+ *
+ * 非线程安全, 并发访问需外部同步
+ */
+
+#include <cstdint>
+
+#include "env.h"
+
+namespace penv {
+    struct HashIndexOptions {
+        // key 最大长度, 决定槽大小, 不超过 255
+        size_t key_capacity = 24;
+        // 初始桶数, 取整为 2 的幂
+        size_t initial_buckets = 1024;
+    };
+
+    class PersistentHashIndex {
+    public:
+        enum {
+            kHeaderSize = 4096,
+            kSlotsPerBucket = 16,
+            kCacheLineSize = 64
+        };
+
+    private:
+        struct Table {
+            uint64_t offset;
+            uint64_t buckets;
+            // 已使用的槽(含删除标记)
+            uint64_t used;
+        };
+
+        struct Header {
+            uint64_t magic;
+            uint64_t key_capacity;
+            uint64_t slot_size;
+            uint64_t bucket_size;
+            uint64_t count;
+            uint64_t file_end;
+            // tables[0] 为当前表, tables[1] 为迁移中的旧表(buckets == 0 表示无)
+            Table tables[2];
+            uint64_t migrate_cursor;
+        };
+
+        MmapFile * file_;
+        char * base_;
+
+    public:
+        static void Init(MmapFile * file, const HashIndexOptions & options = HashIndexOptions());
+
+        // 挂载已 Init 的索引, 之后不应再通过其他途径 Resize file
+        explicit PersistentHashIndex(MmapFile * file);
+
+    public:
+        bool Get(const Slice & key, uint64_t * value) const;
+
+        void Put(const Slice & key, uint64_t value);
+
+        bool Delete(const Slice & key);
+
+        size_t Size() const {
+            return static_cast<size_t>(header()->count);
+        }
+
+        bool Migrating() const {
+            return header()->tables[1].buckets != 0;
+        }
+
+        void Sync() {
+            file_->Sync();
+        }
+
+    private:
+        Header * header() const {
+            return reinterpret_cast<Header *>(base_);
+        }
+
+        char * Bucket(const Table & table, uint64_t index) const {
+            return base_ + table.offset + index * header()->bucket_size;
+        }
+
+        // 返回槽地址, 未找到返回 nullptr; bucket/slot 输出位置
+        char * Find(const Table & table, const Slice & key, uint64_t hash,
+                    char ** bucket = nullptr, size_t * slot = nullptr) const;
+
+        bool EraseFrom(Table * table, const Slice & key, uint64_t hash);
+
+        void InsertNew(Table * table, const Slice & key, uint64_t hash, uint64_t value);
+
+        void StartResize();
+
+        void MigrateStep(size_t buckets);
+    };
+}
+
+#endif //POSIX_ENV_HASH_INDEX_H
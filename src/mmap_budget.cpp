@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <tuple>
+#include <vector>
+
+#include "defs.h"
+#include "mmap_budget.h"
+#include "mmap_file.h"
+#include "page_cache.h"
+
+namespace penv {
+    void MmapBudget::Touch(const PosixMmapFile * file) {
+        uint64_t epoch = epoch_.fetch_add(1, std::memory_order_relaxed) + 1;
+        file->last_access_.store(epoch, std::memory_order_relaxed);
+        // 页可能在没有打开、Resize 的情况下重新载入, 定期检查; 不阻塞访问, 正在检查时跳过
+        if (epoch % kCheckInterval == 0) {
+            std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+            if (lock.owns_lock()) {
+                Enforce(const_cast<PosixMmapFile *>(file));
+            }
+        }
+    }
+
+    void MmapBudget::SetBudget(size_t budget, Env::MmapBudgetPolicy policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.budget = budget;
+        policy_ = policy;
+        Enforce(nullptr);
+    }
+
+    MmapBudgetStats MmapBudget::GetStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.resident_bytes = 0;
+        for (PosixMmapFile * file : files_) {
+            stats_.resident_bytes += Resident(file);
+        }
+        return stats_;
+    }
+
+    void MmapBudget::Register(PosixMmapFile * file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.insert(file);
+        ++stats_.mapped_files;
+        stats_.mapped_bytes += file->len_;
+        file->last_access_.store(epoch_.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        Enforce(file);
+    }
+
+    void MmapBudget::Unregister(PosixMmapFile * file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.erase(file);
+        --stats_.mapped_files;
+        stats_.mapped_bytes -= file->len_;
+    }
+
+    void MmapBudget::Resized(PosixMmapFile * file, size_t old_len) {
+        stats_.mapped_bytes = stats_.mapped_bytes - old_len + file->len_;
+        Enforce(file);
+    }
+
+    size_t MmapBudget::Resident(const PosixMmapFile * file) {
+        size_t resident;
+        if (Cachestat(file->fd_, 0, file->len_, &resident)) {
+            return resident;
+        }
+        std::vector<std::pair<size_t, size_t>> ranges;
+        // 测量失败时按全部驻留计
+        if (!MincoreRanges(file->base_, file->len_, 0, &ranges)) {
+            return file->len_;
+        }
+        resident = 0;
+        for (const auto & range : ranges) {
+            resident += range.second;
+        }
+        return resident;
+    }
+
+    void MmapBudget::Enforce(PosixMmapFile * keep) {
+        // 驻留量不超过映射总量, 此时无需逐个测量
+        if (stats_.budget == 0 || stats_.mapped_bytes <= stats_.budget) {
+            return;
+        }
+        std::vector<std::tuple<uint64_t, PosixMmapFile *, size_t>> candidates;
+        candidates.reserve(files_.size());
+        size_t resident = 0;
+        for (PosixMmapFile * file : files_) {
+            size_t n = Resident(file);
+            resident += n;
+            if (file != keep && n != 0) {
+                candidates.emplace_back(file->last_access_.load(std::memory_order_relaxed), file, n);
+            }
+        }
+        stats_.resident_bytes = resident;
+        if (resident <= stats_.budget) {
+            return;
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        size_t target = stats_.budget - stats_.budget / 8;
+        for (const auto & candidate : candidates) {
+            if (resident <= target) {
+                break;
+            }
+            resident -= Reclaim(std::get<1>(candidate), std::get<2>(candidate));
+        }
+    }
+
+    // 只作用于页, 不改变 base_, 其他线程持有的指针不受影响
+    size_t MmapBudget::Reclaim(PosixMmapFile * file, size_t resident) {
+        ++stats_.advised;
+        if (policy_ == Env::kMmapAdviseCold) {
+#if defined(MADV_COLD)
+            // 不立即释放, 内存紧张时内核优先回收这些页, 因此计入已回收但不改变测得的驻留量
+            madvise(file->base_, file->len_, MADV_COLD);
+            return resident;
+#endif
+        }
+        // 共享映射上的 DONTNEED 只解除页表, 脏页仍在 page cache 中不会丢失, 也不会被 fadvise 逐出
+        madvise(file->base_, file->len_, MADV_DONTNEED);
+        posix_fadvise(file->fd_, 0, static_cast<off_t>(file->len_), POSIX_FADV_DONTNEED);
+        size_t freed = resident - std::min(resident, Resident(file));
+        stats_.resident_bytes -= freed;
+        return freed;
+    }
+}
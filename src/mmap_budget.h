@@ -0,0 +1,75 @@
+#pragma once
+#ifndef POSIX_ENV_MMAP_BUDGET_H
+#define POSIX_ENV_MMAP_BUDGET_H
+
+/*
+ * 全局映射内存预算
+ * 预算针对映射文件实际驻留在 page cache 中的字节数(cgroup 同样按此计费), 由 cachestat/mincore 测得
+ * 每次访问(Base()、Touch())记录访问纪元, 纪元只在最近访问的文件变化时推进, 反复访问同一文件不产生竞争
+ * 打开、Resize、设置预算时以及纪元每推进 kCheckInterval 次检查一次,
+ * 超出预算时按纪元从旧到新回收到预算的 7/8
+ * 回收只通过 madvise 释放页, 不解除映射, 库内缓存 Base() 指针的组件(环形缓冲、哈希索引)不受影响
+ */
+
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+#include "env.h"
+
+namespace penv {
+    class PosixMmapFile;
+
+    class MmapBudget {
+    private:
+        enum {
+            kCheckInterval = 4096
+        };
+
+        std::mutex mutex_;
+        std::unordered_set<PosixMmapFile *> files_;
+        Env::MmapBudgetPolicy policy_;
+        MmapBudgetStats stats_;
+        std::atomic<uint64_t> epoch_;
+
+    public:
+        MmapBudget()
+                : policy_(Env::kMmapAdviseCold),
+                  epoch_(0) {}
+
+    public:
+        uint64_t Epoch() const {
+            return epoch_.load(std::memory_order_relaxed);
+        }
+
+        // 推进纪元并记为 file 的最近访问
+        void Touch(const PosixMmapFile * file);
+
+        void SetBudget(size_t budget, Env::MmapBudgetPolicy policy);
+
+        MmapBudgetStats GetStats();
+
+        void Register(PosixMmapFile * file);
+
+        void Unregister(PosixMmapFile * file);
+
+        // 回收会读取映射地址与长度, 改变它们的操作须持有此锁, 完成后调用 Resized
+        std::unique_lock<std::mutex> Lock() {
+            return std::unique_lock<std::mutex>(mutex_);
+        }
+
+        void Resized(PosixMmapFile * file, size_t old_len);
+
+    private:
+        // 以下要求持有 mutex_
+
+        static size_t Resident(const PosixMmapFile * file);
+
+        void Enforce(PosixMmapFile * keep);
+
+        // 返回视为释放的字节数
+        size_t Reclaim(PosixMmapFile * file, size_t resident);
+    };
+}
+
+#endif //POSIX_ENV_MMAP_BUDGET_H
@@ -1,68 +1,142 @@
 #include <cerrno>
 #include <fcntl.h>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "defs.h"
 #include "mmap_file.h"
+#include "page_cache.h"
 
 #define IO_EXCEPTION(f) std::runtime_error("IO:" + PENV_EXCEPTION_INFO + " | " + strerror(errno) + " | " + (f))
 
 namespace penv {
+    PosixMmapFile::PosixMmapFile(std::string fname, void * base, size_t len, int fd, MmapBudget * budget)
+            : fname_(std::move(fname)),
+              base_(base),
+              len_(len),
+              fd_(fd),
+              budget_(budget),
+              last_access_(0) {
+        if (budget_ != nullptr) {
+            budget_->Register(this);
+        }
+    }
+
     PosixMmapFile::~PosixMmapFile() {
+        if (budget_ != nullptr) {
+            budget_->Unregister(this);
+        }
         munmap(base_, len_);
         close(fd_);
     }
 
     void PosixMmapFile::Resize(size_t n) {
-        int r;
+        // 磁盘分配可能很慢, 在预算锁外进行; len_ 只由本对象修改
+        int r = 0;
 #if defined(PENV_OS_MACOSX)
         r = ftruncate(fd_, static_cast<off_t>(n));
 #else
-        r = fallocate(fd_, 0, 0, static_cast<off_t>(n));
+        // 只分配新增的部分, 已打洞(如 MADV_REMOVE 释放)的区间保持稀疏
+        if (n > len_) {
+            r = fallocate(fd_, 0, static_cast<off_t>(len_), static_cast<off_t>(n - len_));
+        }
 #endif
         if (r != 0) {
             throw IO_EXCEPTION(fname_);
         }
 
+        std::unique_lock<std::mutex> lock;
+        if (budget_ != nullptr) {
+            lock = budget_->Lock();
+        }
+        size_t old_len = len_;
+
 #if defined(PENV_OS_MACOSX)
         if (munmap(base_, len_) != 0) {
             throw IO_EXCEPTION(fname_);
         }
-        base_ = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        void * base = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
 #else
-        base_ = mremap(base_, len_, n, MREMAP_MAYMOVE);
+        void * base = mremap(base_, len_, n, MREMAP_MAYMOVE);
 #endif
-        len_ = n;
-        if (base_ == MAP_FAILED) {
+        // 失败时不改动 base_/len_, 以免回收时作用于无效地址
+        if (base == MAP_FAILED) {
             throw IO_EXCEPTION(fname_);
         }
+        base_ = base;
+        len_ = n;
+        if (budget_ != nullptr) {
+            budget_->Resized(this, old_len);
+        }
     }
 
     void PosixMmapFile::Sync() {
+        Touch();
         if (msync(base_, len_, MS_SYNC) != 0) {
             throw IO_EXCEPTION(fname_);
         }
     }
 
     void PosixMmapFile::Hint(AccessPattern hint) {
+        RangeHint(0, 0, hint);
+    }
+
+    void PosixMmapFile::RangeHint(size_t offset, size_t n, AccessPattern hint) {
+        size_t end = (n == 0 || offset + n > len_) ? len_ : offset + n;
+        if (offset >= end) {
+            return;
+        }
+        // madvise 要求起始地址按页对齐
+        size_t begin = offset / PageSize() * PageSize();
+        char * addr = static_cast<char *>(base_) + begin;
+        size_t len = end - begin;
         switch (hint) {
             case NORMAL:
-                posix_madvise(base_, len_, POSIX_MADV_NORMAL);
+                posix_madvise(addr, len, POSIX_MADV_NORMAL);
                 break;
             case SEQUENTIAL:
-                posix_madvise(base_, len_, POSIX_MADV_SEQUENTIAL);
+                posix_madvise(addr, len, POSIX_MADV_SEQUENTIAL);
                 break;
             case RANDOM:
-                posix_madvise(base_, len_, POSIX_MADV_RANDOM);
+                posix_madvise(addr, len, POSIX_MADV_RANDOM);
                 break;
             case WILLNEED:
-                posix_madvise(base_, len_, POSIX_MADV_WILLNEED);
+                posix_madvise(addr, len, POSIX_MADV_WILLNEED);
                 break;
             default:
                 assert(hint == DONTNEED);
-                posix_madvise(base_, len_, POSIX_MADV_DONTNEED);
+                // glibc 的 POSIX_MADV_DONTNEED 什么也不做, 页仍被映射时 fadvise 无法逐出
+                madvise(addr, len, MADV_DONTNEED);
+                posix_fadvise(fd_, static_cast<off_t>(begin), static_cast<off_t>(len), POSIX_FADV_DONTNEED);
                 break;
         }
     }
+
+    size_t PosixMmapFile::GetResidentSize(size_t offset, size_t n) const {
+        size_t resident;
+        if (Cachestat(fd_, offset, n, &resident)) {
+            return resident;
+        }
+        std::vector<std::pair<size_t, size_t>> ranges;
+        GetResidentRanges(offset, n, &ranges);
+        resident = 0;
+        for (const auto & range : ranges) {
+            resident += range.second;
+        }
+        return resident;
+    }
+
+    void PosixMmapFile::GetResidentRanges(size_t offset, size_t n,
+                                          std::vector<std::pair<size_t, size_t>> * result) const {
+        result->clear();
+        size_t end = (n == 0 || offset + n > len_) ? len_ : offset + n;
+        if (offset >= end) {
+            return;
+        }
+        size_t begin = offset / PageSize() * PageSize();
+        if (!MincoreRanges(static_cast<const char *>(base_) + begin, end - begin, begin, result)) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
 }
\ No newline at end of file
@@ -3,30 +3,36 @@
 #define POSIX_ENV_MMAP_FILE_H
 
 #include "env.h"
+#include "mmap_budget.h"
 
 namespace penv {
     class PosixMmapFile : public MmapFile {
     private:
+        friend class MmapBudget;
+
+        friend class PosixMmapWritableFile;
+
         std::string fname_;
         void * base_;
         size_t len_;
         int fd_;
+        // 以下仅在 budget_ 非空时使用
+        MmapBudget * budget_;
+        mutable std::atomic<uint64_t> last_access_;
 
     public:
-        PosixMmapFile(std::string fname, void * base, size_t len, int fd)
-                : fname_(std::move(fname)),
-                  base_(base),
-                  len_(len),
-                  fd_(fd) {}
+        PosixMmapFile(std::string fname, void * base, size_t len, int fd, MmapBudget * budget = nullptr);
 
         ~PosixMmapFile() override;
 
     public:
         void * Base() override {
+            Touch();
             return base_;
         }
 
         const void * Base() const override {
+            Touch();
             return base_;
         }
 
@@ -39,6 +45,20 @@ namespace penv {
         void Sync() override;
 
         void Hint(AccessPattern hint) override;
+
+        void RangeHint(size_t offset, size_t n, AccessPattern hint) override;
+
+        size_t GetResidentSize(size_t offset, size_t n) const override;
+
+        void GetResidentRanges(size_t offset, size_t n,
+                               std::vector<std::pair<size_t, size_t>> * result) const override;
+
+        // 已是最近访问的文件时只需一次原子读
+        void Touch() const override {
+            if (budget_ != nullptr && last_access_.load(std::memory_order_relaxed) != budget_->Epoch()) {
+                budget_->Touch(this);
+            }
+        }
     };
 }
 
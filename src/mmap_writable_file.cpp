@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "defs.h"
+#include "mmap_writable_file.h"
+#include "page_cache.h"
+#include "writable_file.h"
+
+#define IO_EXCEPTION(f) std::runtime_error("IO:" + PENV_EXCEPTION_INFO + " | " + strerror(errno) + " | " + (f))
+
+namespace penv {
+    PosixMmapWritableFile::~PosixMmapWritableFile() {
+        ftruncate(file_.fd_, static_cast<off_t>(filesize_));
+    }
+
+    void PosixMmapWritableFile::Write(const Slice & data) {
+        Reserve(filesize_ + data.size());
+        memcpy(static_cast<char *>(file_.Base()) + filesize_, data.data(), data.size());
+        filesize_ += data.size();
+    }
+
+    void PosixMmapWritableFile::Truncate(size_t n) {
+        Reserve(n);
+        if (n > filesize_) {
+            memset(static_cast<char *>(file_.Base()) + filesize_, 0, n - filesize_);
+        }
+        filesize_ = n;
+        synced_ = std::min(synced_, n);
+    }
+
+    void PosixMmapWritableFile::Sync() {
+        size_t begin = synced_ / PageSize() * PageSize();
+        if (filesize_ > begin) {
+            if (msync(static_cast<char *>(file_.Base()) + begin, filesize_ - begin, MS_SYNC) != 0) {
+                throw IO_EXCEPTION(file_.fname_);
+            }
+        }
+        synced_ = filesize_;
+    }
+
+    void PosixMmapWritableFile::Hint(WriteLifeTimeHint hint) {
+#if defined(PENV_OS_LINUX) && defined(F_SET_RW_HINT)
+        fcntl(file_.fd_, F_SET_RW_HINT, &hint);
+#endif
+    }
+
+    void PosixMmapWritableFile::RangeSync(size_t offset, size_t n) {
+        size_t end = std::min(offset + n, filesize_);
+        size_t begin = offset / PageSize() * PageSize();
+        if (end > begin) {
+            if (msync(static_cast<char *>(file_.Base()) + begin, end - begin, MS_ASYNC) != 0) {
+                throw IO_EXCEPTION(file_.fname_);
+            }
+        }
+    }
+
+    void PosixMmapWritableFile::PrepareWrite(size_t offset, size_t n) {
+        Reserve(offset + n);
+    }
+
+    void PosixMmapWritableFile::Allocate(size_t offset, size_t n) {
+        Reserve(offset + n);
+    }
+
+    void PosixMmapWritableFile::PunchHole(size_t offset, size_t n) {
+        if (PosixWritableFile::FallocateRange(file_.fd_, PosixWritableFile::kPunchHole, offset, n) != 0) {
+            throw IO_EXCEPTION(file_.fname_);
+        }
+    }
+
+    void PosixMmapWritableFile::CollapseRange(size_t offset, size_t n) {
+        if (PosixWritableFile::FallocateRange(file_.fd_, PosixWritableFile::kCollapseRange, offset, n) != 0) {
+            throw IO_EXCEPTION(file_.fname_);
+        }
+        if (offset < filesize_) {
+            filesize_ -= std::min(n, filesize_ - offset);
+        }
+        synced_ = std::min(synced_, offset);
+        // 文件缩短后映射尾部越过了文件末尾, 补回空洞以免访问时 SIGBUS
+        if (ftruncate(file_.fd_, static_cast<off_t>(file_.GetFileSize())) != 0) {
+            throw IO_EXCEPTION(file_.fname_);
+        }
+    }
+
+    void PosixMmapWritableFile::InsertRange(size_t offset, size_t n) {
+        if (PosixWritableFile::FallocateRange(file_.fd_, PosixWritableFile::kInsertRange, offset, n) != 0) {
+            throw IO_EXCEPTION(file_.fname_);
+        }
+        if (offset < filesize_) {
+            filesize_ += n;
+        }
+        synced_ = std::min(synced_, offset);
+        Reserve(filesize_);
+    }
+
+    void PosixMmapWritableFile::ZeroRange(size_t offset, size_t n) {
+        if (PosixWritableFile::FallocateRange(file_.fd_, PosixWritableFile::kZeroRange, offset, n) != 0) {
+            throw IO_EXCEPTION(file_.fname_);
+        }
+    }
+
+    void PosixMmapWritableFile::Reserve(size_t n) {
+        if (n > file_.GetFileSize()) {
+            file_.Resize((n + kGrowthBlockSize - 1) / kGrowthBlockSize * kGrowthBlockSize);
+        }
+    }
+}
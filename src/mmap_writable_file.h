@@ -0,0 +1,66 @@
+#pragma once
+#ifndef POSIX_ENV_MMAP_WRITABLE_FILE_H
+#define POSIX_ENV_MMAP_WRITABLE_FILE_H
+
+/*
+ * 基于共享映射的追加写文件
+ * Write 只是 memcpy, 映射按块增长, 析构时截断到实际大小
+ * 注意: 崩溃后文件尾部可能残留预分配的零
+ */
+
+#include "env.h"
+#include "mmap_file.h"
+
+namespace penv {
+    class PosixMmapWritableFile : public WritableFile {
+    private:
+        enum {
+            kGrowthBlockSize = 4 * 1024 * 1024
+        };
+
+        PosixMmapFile file_;
+        size_t filesize_;
+        size_t synced_;
+
+    public:
+        PosixMmapWritableFile(std::string fname, void * base, size_t len, int fd, size_t filesize,
+                              MmapBudget * budget = nullptr)
+                : file_(std::move(fname), base, len, fd, budget),
+                  filesize_(filesize),
+                  synced_(filesize) {}
+
+        ~PosixMmapWritableFile() override;
+
+    public:
+        void Write(const Slice & data) override;
+
+        void Truncate(size_t n) override;
+
+        void Sync() override;
+
+        size_t GetFileSize() const override {
+            return filesize_;
+        }
+
+        void Hint(WriteLifeTimeHint hint) override;
+
+        void RangeSync(size_t offset, size_t n) override;
+
+        void PrepareWrite(size_t offset, size_t n) override;
+
+        void Allocate(size_t offset, size_t n) override;
+
+        void PunchHole(size_t offset, size_t n) override;
+
+        void CollapseRange(size_t offset, size_t n) override;
+
+        void InsertRange(size_t offset, size_t n) override;
+
+        void ZeroRange(size_t offset, size_t n) override;
+
+    private:
+        void Reserve(size_t n);
+    };
+}
+
+#endif //POSIX_ENV_MMAP_WRITABLE_FILE_H
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef POSIX_ENV_PAGE_CACHE_H
+#define POSIX_ENV_PAGE_CACHE_H
+
+/*
+ * page cache 驻留查询
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+
+namespace penv {
+    inline size_t PageSize() {
+        static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return page_size;
+    }
+
+    // base 需按页对齐, base 对应文件偏移 file_offset
+    // 驻留区间以 (offset, length) 追加到 result, 相邻区间会合并
+    inline bool MincoreRanges(const void * base, size_t len, size_t file_offset,
+                              std::vector<std::pair<size_t, size_t>> * result) {
+        enum {
+            kChunkPages = 64 * 1024
+        };
+        const size_t page_size = PageSize();
+        size_t pages = (len + page_size - 1) / page_size;
+#if defined(PENV_OS_MACOSX)
+        std::vector<char> vec(std::min<size_t>(pages, kChunkPages));
+#else
+        std::vector<unsigned char> vec(std::min<size_t>(pages, kChunkPages));
+#endif
+        for (size_t i = 0; i < pages; i += kChunkPages) {
+            size_t count = std::min<size_t>(pages - i, kChunkPages);
+            auto * addr = static_cast<char *>(const_cast<void *>(base)) + i * page_size;
+            if (mincore(addr, std::min(count * page_size, len - i * page_size), vec.data()) != 0) {
+                return false;
+            }
+            for (size_t j = 0; j < count; ++j) {
+                if ((vec[j] & 1) == 0) {
+                    continue;
+                }
+                size_t offset = file_offset + (i + j) * page_size;
+                if (!result->empty() && result->back().first + result->back().second == offset) {
+                    result->back().second += page_size;
+                } else {
+                    result->emplace_back(offset, page_size);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Linux 6.5+ 的 cachestat 无需建立映射, 不支持时返回 false
+    // 只在编译时的内核头文件定义了 __NR_cachestat 时启用, 否则总是返回 false, 调用方退回 mmap + mincore
+    inline bool Cachestat(int fd, size_t offset, size_t n, size_t * resident) {
+#if defined(PENV_OS_LINUX) && defined(__NR_cachestat)
+        struct {
+            uint64_t off;
+            uint64_t len;
+        } range = {offset, n};
+        struct {
+            uint64_t nr_cache;
+            uint64_t nr_dirty;
+            uint64_t nr_writeback;
+            uint64_t nr_evicted;
+            uint64_t nr_recently_evicted;
+        } cs = {};
+        if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0) {
+            *resident = static_cast<size_t>(cs.nr_cache) * PageSize();
+            return true;
+        }
+#else
+        (void) fd;
+        (void) offset;
+        (void) n;
+        (void) resident;
+#endif
+        return false;
+    }
+}
+
+#endif //POSIX_ENV_PAGE_CACHE_H
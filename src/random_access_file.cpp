@@ -1,29 +1,30 @@
+#include <algorithm>
 #include <cerrno>
 #include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "defs.h"
+#include "page_cache.h"
 #include "random_access_file.h"
 
 #define IO_EXCEPTION(f) std::runtime_error("IO:" + PENV_EXCEPTION_INFO + " | " + strerror(errno) + " | " + (f))
 
-#if defined(PENV_OS_MACOSX)
-#define POSIX_FADV_NORMAL
-#define POSIX_FADV_SEQUENTIAL
-#define POSIX_FADV_RANDOM
-#define POSIX_FADV_NOREUSE
-#define POSIX_FADV_WILLNEED
-#define POSIX_FADV_DONTNEED
-
-#define posix_fadvise(fd, offset, len, advice) 0
-#endif
-
 namespace penv {
     PosixRandomAccessFile::~PosixRandomAccessFile() {
         close(fd_);
     }
 
     void PosixRandomAccessFile::ReadAt(size_t offset, size_t n, char * scratch) const {
+        Status s = TryReadAt(offset, n, scratch);
+        if (!s.ok()) {
+            throw s.ToException(fname_);
+        }
+    }
+
+    Status PosixRandomAccessFile::TryReadAt(size_t offset, size_t n, char * scratch) const noexcept {
         size_t left = n;
         char * ptr = scratch;
         while (left != 0) {
@@ -32,50 +33,211 @@ namespace penv {
                 if (errno == EINTR) {
                     continue;
                 }
-                throw IO_EXCEPTION(fname_);
+                return PENV_STATUS(errno);
+            }
+            if (done == 0) {
+                return PENV_STATUS(Status::kEndOfFile);
             }
             left -= done;
             ptr += done;
             offset += done;
         }
+        if (adaptive_.load(std::memory_order_relaxed)) {
+            UpdateReadahead(offset - n, n);
+        }
+        return Status();
     }
 
     void PosixRandomAccessFile::Prefetch(size_t offset, size_t n) {
-        ssize_t r = 0;
-#if defined(PENV_OS_LINUX)
-        r = readahead(fd_, offset, n);
-#endif
-#if defined(PENV_OS_MACOSX)
-        radvisory advice = {static_cast<off_t>(offset),
-                            static_cast<int>(n)};
-        r = fcntl(fd_, F_RDADVISE, &advice);
-#endif
-        if (r < 0) {
+        if (!Readahead(offset, n)) {
             throw IO_EXCEPTION(fname_);
         }
     }
 
     void PosixRandomAccessFile::Hint(AccessPattern hint) {
+        adaptive_.store(hint == ADAPTIVE, std::memory_order_relaxed);
+        if (hint == ADAPTIVE) {
+            std::lock_guard<std::mutex> lock(readahead_mutex_);
+            for (ReadaheadStream & stream : streams_) {
+                stream = ReadaheadStream();
+            }
+            stream_tick_ = 0;
+        }
+        Advise(0, 0, hint);
+    }
+
+    void PosixRandomAccessFile::RangeHint(size_t offset, size_t n, AccessPattern hint) {
+        // 自适应预读按文件开启, 无法限定在区间内
+        if (hint == ADAPTIVE) {
+            Hint(hint);
+        } else {
+            Advise(offset, n, hint);
+        }
+    }
+
+    void PosixRandomAccessFile::Advise(size_t offset, size_t n, AccessPattern hint) {
+        auto off = static_cast<off_t>(offset);
+        auto len = static_cast<off_t>(n);
         switch (hint) {
             case NORMAL:
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_NORMAL);
+                posix_fadvise(fd_, off, len, POSIX_FADV_NORMAL);
                 break;
             case SEQUENTIAL:
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+                posix_fadvise(fd_, off, len, POSIX_FADV_SEQUENTIAL);
                 break;
             case RANDOM:
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_RANDOM);
+                posix_fadvise(fd_, off, len, POSIX_FADV_RANDOM);
                 break;
             case NOREUSE:
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_NOREUSE);
+                posix_fadvise(fd_, off, len, POSIX_FADV_NOREUSE);
                 break;
             case WILLNEED:
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_WILLNEED);
+                posix_fadvise(fd_, off, len, POSIX_FADV_WILLNEED);
+                break;
+            case ADAPTIVE:
+                // 关闭内核自带的预读, 由 UpdateReadahead 接管
+                posix_fadvise(fd_, off, len, POSIX_FADV_RANDOM);
                 break;
             default:
                 assert(hint == DONTNEED);
-                posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+                posix_fadvise(fd_, off, len, POSIX_FADV_DONTNEED);
                 break;
         }
     }
+
+    size_t PosixRandomAccessFile::GetResidentSize(size_t offset, size_t n) const {
+        size_t resident;
+        if (Cachestat(fd_, offset, n, &resident)) {
+            return resident;
+        }
+        std::vector<std::pair<size_t, size_t>> ranges;
+        GetResidentRanges(offset, n, &ranges);
+        resident = 0;
+        for (const auto & range : ranges) {
+            resident += range.second;
+        }
+        return resident;
+    }
+
+    void PosixRandomAccessFile::GetResidentRanges(size_t offset, size_t n,
+                                                  std::vector<std::pair<size_t, size_t>> * result) const {
+        result->clear();
+        struct stat sbuf;
+        if (fstat(fd_, &sbuf) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        auto filesize = static_cast<size_t>(sbuf.st_size);
+        size_t end = (n == 0 || offset + n > filesize) ? filesize : offset + n;
+        if (offset >= end) {
+            return;
+        }
+
+        // mincore 需要映射, 只读映射不会触发缺页
+        size_t begin = offset / PageSize() * PageSize();
+        void * base = mmap(nullptr, end - begin, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(begin));
+        if (base == MAP_FAILED) {
+            throw IO_EXCEPTION(fname_);
+        }
+        bool ok = MincoreRanges(base, end - begin, begin, result);
+        munmap(base, end - begin);
+        if (!ok) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
+
+    size_t PosixRandomAccessFile::SeekData(size_t offset) const {
+#if defined(SEEK_DATA)
+        off_t r = lseek(fd_, static_cast<off_t>(offset), SEEK_DATA);
+        if (r >= 0) {
+            return static_cast<size_t>(r);
+        }
+        if (errno != ENXIO) {
+            throw IO_EXCEPTION(fname_);
+        }
+        // offset 之后没有数据
+        struct stat sbuf;
+        if (fstat(fd_, &sbuf) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        return std::max(offset, static_cast<size_t>(sbuf.st_size));
+#else
+        return offset;
+#endif
+    }
+
+    size_t PosixRandomAccessFile::SeekHole(size_t offset) const {
+#if defined(SEEK_HOLE)
+        off_t r = lseek(fd_, static_cast<off_t>(offset), SEEK_HOLE);
+        if (r >= 0) {
+            return static_cast<size_t>(r);
+        }
+        if (errno != ENXIO) {
+            throw IO_EXCEPTION(fname_);
+        }
+        return offset;
+#else
+        struct stat sbuf;
+        if (fstat(fd_, &sbuf) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        return std::max(offset, static_cast<size_t>(sbuf.st_size));
+#endif
+    }
+
+    bool PosixRandomAccessFile::Readahead(size_t offset, size_t n) const {
+        ssize_t r = 0;
+#if defined(PENV_OS_LINUX)
+        r = readahead(fd_, offset, n);
+#endif
+#if defined(PENV_OS_MACOSX)
+        radvisory advice = {static_cast<off_t>(offset),
+                            static_cast<int>(n)};
+        r = fcntl(fd_, F_RDADVISE, &advice);
+#endif
+        return r >= 0;
+    }
+
+    // 每个顺序流前向读时窗口翻倍增长; 不接续任何流的读开启新流,
+    // 替换最久未用的流, 优先替换尚未形成顺序模式的
+    void PosixRandomAccessFile::UpdateReadahead(size_t offset, size_t n) const {
+        size_t ra_offset = 0;
+        size_t ra_size = 0;
+        {
+            std::lock_guard<std::mutex> lock(readahead_mutex_);
+            size_t end = offset + n;
+            ReadaheadStream * stream = nullptr;
+            ReadaheadStream * victim = &streams_[0];
+            for (ReadaheadStream & candidate : streams_) {
+                if (candidate.last_use != 0 && candidate.prev_end == offset) {
+                    stream = &candidate;
+                    break;
+                }
+                bool idle = candidate.sequential_count < kSequentialThreshold;
+                bool victim_idle = victim->sequential_count < kSequentialThreshold;
+                if ((idle && !victim_idle) || (idle == victim_idle && candidate.last_use < victim->last_use)) {
+                    victim = &candidate;
+                }
+            }
+
+            if (stream != nullptr) {
+                if (++stream->sequential_count >= kSequentialThreshold &&
+                    end + stream->readahead_size / 2 > stream->readahead_end) {
+                    ra_offset = std::max(end, stream->readahead_end);
+                    ra_size = stream->readahead_size;
+                    stream->readahead_end = ra_offset + ra_size;
+                    stream->readahead_size = std::min<size_t>(stream->readahead_size * 2, kMaxReadaheadSize);
+                }
+            } else {
+                stream = victim;
+                *stream = ReadaheadStream();
+                stream->readahead_end = end;
+            }
+            stream->prev_end = end;
+            stream->last_use = ++stream_tick_;
+        }
+        if (ra_size != 0) {
+            // 预读只是建议, 失败不影响读本身
+            Readahead(ra_offset, ra_size);
+        }
+    }
 }
\ No newline at end of file
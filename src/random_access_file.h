@@ -2,27 +2,75 @@
 #ifndef POSIX_ENV_RANDOM_ACCESS_FILE_H
 #define POSIX_ENV_RANDOM_ACCESS_FILE_H
 
+#include <atomic>
+#include <mutex>
+
 #include "env.h"
 
 namespace penv {
     class PosixRandomAccessFile : public RandomAccessFile {
     private:
+        enum {
+            kMinReadaheadSize = 64 * 1024,
+            kMaxReadaheadSize = 2 * 1024 * 1024,
+            // 连续几次顺序读后才开始预读
+            kSequentialThreshold = 2,
+            // 同时跟踪的顺序流个数, 多个迭代器交错读同一文件时互不干扰
+            kMaxStreams = 4
+        };
+
+        // 按期望的下一个偏移 prev_end 匹配 ReadAt
+        struct ReadaheadStream {
+            size_t prev_end = 0;
+            size_t readahead_end = 0;
+            size_t readahead_size = kMinReadaheadSize;
+            size_t sequential_count = 0;
+            uint64_t last_use = 0;
+        };
+
         std::string fname_;
         int fd_;
 
+        std::atomic<bool> adaptive_;
+        mutable std::mutex readahead_mutex_;
+        mutable ReadaheadStream streams_[kMaxStreams];
+        mutable uint64_t stream_tick_;
+
     public:
         PosixRandomAccessFile(std::string fname, int fd)
                 : fname_(std::move(fname)),
-                  fd_(fd) {}
+                  fd_(fd),
+                  adaptive_(false),
+                  stream_tick_(0) {}
 
         ~PosixRandomAccessFile() override;
 
     public:
         void ReadAt(size_t offset, size_t n, char * scratch) const override;
 
+        Status TryReadAt(size_t offset, size_t n, char * scratch) const noexcept override;
+
         void Prefetch(size_t offset, size_t n) override;
 
         void Hint(AccessPattern hint) override;
+
+        void RangeHint(size_t offset, size_t n, AccessPattern hint) override;
+
+        size_t GetResidentSize(size_t offset, size_t n) const override;
+
+        void GetResidentRanges(size_t offset, size_t n,
+                               std::vector<std::pair<size_t, size_t>> * result) const override;
+
+        size_t SeekData(size_t offset) const override;
+
+        size_t SeekHole(size_t offset) const override;
+
+    private:
+        void Advise(size_t offset, size_t n, AccessPattern hint);
+
+        bool Readahead(size_t offset, size_t n) const;
+
+        void UpdateReadahead(size_t offset, size_t n) const;
     };
 }
 
@@ -0,0 +1,230 @@
+#include <climits>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "defs.h"
+#include "ring_buffer.h"
+
+#define RING_EXCEPTION(msg) std::runtime_error("Ring:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr uint64_t kRingMagic = 0x474e4952564e4550; // "PENVRING"
+
+        constexpr uint64_t kCommitted = 1;
+        constexpr uint64_t kPadding = 2;
+
+        inline size_t Align8(size_t n) {
+            return (n + 7) & ~size_t(7);
+        }
+
+        // 进程间共享, 不能用 FUTEX_PRIVATE_FLAG
+        void FutexWait(std::atomic<uint32_t> * addr, uint32_t expected) {
+#if defined(PENV_OS_LINUX)
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+#else
+            if (addr->load(std::memory_order_acquire) == expected) {
+                std::this_thread::yield();
+            }
+#endif
+        }
+
+        void FutexWake(std::atomic<uint32_t> * addr) {
+#if defined(PENV_OS_LINUX)
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+
+        // 先登记再复查条件, 与 Notify 端的 fence 配对避免丢失唤醒
+        template<typename Ready>
+        void WaitUntil(std::atomic<uint32_t> * seq, std::atomic<uint32_t> * waiters, Ready && ready) {
+            while (!ready()) {
+                uint32_t expected = seq->load(std::memory_order_acquire);
+                waiters->fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!ready()) {
+                    FutexWait(seq, expected);
+                }
+                waiters->fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        void Notify(std::atomic<uint32_t> * seq, std::atomic<uint32_t> * waiters) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters->load(std::memory_order_relaxed) != 0) {
+                seq->fetch_add(1, std::memory_order_release);
+                FutexWake(seq);
+            }
+        }
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::Init(MmapFile * file, size_t capacity) {
+        if (capacity < kHeaderSize || (capacity & (capacity - 1)) != 0) {
+            throw RING_EXCEPTION("capacity must be a power of 2 no less than " + std::to_string(kHeaderSize));
+        }
+        file->Resize(kHeaderSize + capacity);
+        memset(file->Base(), 0, kHeaderSize + capacity);
+
+        auto * header = new(file->Base()) RingBufferHeader();
+        header->capacity = capacity;
+        header->multi_producer = kMultiProducer;
+        header->head.store(0, std::memory_order_relaxed);
+        header->tail.store(0, std::memory_order_relaxed);
+        header->data_seq.store(0, std::memory_order_relaxed);
+        header->data_waiters.store(0, std::memory_order_relaxed);
+        header->space_seq.store(0, std::memory_order_relaxed);
+        header->space_waiters.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = kRingMagic;
+    }
+
+    template<bool kMultiProducer>
+    BasicRingBuffer<kMultiProducer>::BasicRingBuffer(MmapFile * file)
+            : file_(file) {
+        if (file->GetFileSize() < kHeaderSize) {
+            throw RING_EXCEPTION("file too small");
+        }
+        header_ = static_cast<RingBufferHeader *>(file->Base());
+        data_ = static_cast<char *>(file->Base()) + kHeaderSize;
+        capacity_ = header_->capacity;
+        if (header_->magic != kRingMagic) {
+            throw RING_EXCEPTION("bad magic");
+        }
+        if (header_->multi_producer != kMultiProducer) {
+            throw RING_EXCEPTION("producer mode mismatch");
+        }
+        if (file->GetFileSize() < kHeaderSize + capacity_) {
+            throw RING_EXCEPTION("file too small");
+        }
+    }
+
+    template<bool kMultiProducer>
+    bool BasicRingBuffer<kMultiProducer>::TryPush(const Slice & record) {
+        size_t need = sizeof(uint64_t) + Align8(record.size());
+        if (need > capacity_ / 2) {
+            throw RING_EXCEPTION("record too large: " + std::to_string(record.size()));
+        }
+        file_->Touch();
+
+        // 尾部连续空间不足时用填充记录补齐, 记录从头开始
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        uint64_t total;
+        do {
+            size_t contiguous = capacity_ - (head & (capacity_ - 1));
+            total = contiguous < need ? contiguous + need : need;
+            if (head + total - header_->tail.load(std::memory_order_acquire) > capacity_) {
+                return false;
+            }
+            if constexpr (!kMultiProducer) {
+                header_->head.store(head + total, std::memory_order_relaxed);
+                break;
+            }
+        } while (!header_->head.compare_exchange_weak(head, head + total, std::memory_order_relaxed));
+
+        uint64_t pos = head;
+        if (total != need) {
+            WordAt(pos)->store(((total - need) << 2) | kPadding | kCommitted, std::memory_order_release);
+            pos += total - need;
+        }
+        memcpy(data_ + (pos & (capacity_ - 1)) + sizeof(uint64_t), record.data(), record.size());
+        WordAt(pos)->store((uint64_t(record.size()) << 2) | kCommitted, std::memory_order_release);
+        NotifyConsumer();
+        return true;
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::Push(const Slice & record) {
+        while (!TryPush(record)) {
+            size_t need = sizeof(uint64_t) + Align8(record.size());
+            WaitUntil(&header_->space_seq, &header_->space_waiters, [this, need]() {
+                // 按最坏情况(需要填充)估计
+                return header_->head.load(std::memory_order_relaxed) + 2 * need
+                       - header_->tail.load(std::memory_order_acquire) <= capacity_;
+            });
+        }
+    }
+
+    template<bool kMultiProducer>
+    bool BasicRingBuffer<kMultiProducer>::TryPeek(Slice * record) {
+        file_->Touch();
+        while (true) {
+            uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+            uint64_t word = WordAt(tail)->load(std::memory_order_acquire);
+            if ((word & kCommitted) == 0) {
+                return false;
+            }
+            size_t len = static_cast<size_t>(word >> 2);
+            char * p = data_ + (tail & (capacity_ - 1));
+            if ((word & kPadding) != 0) {
+                // 消费者清零已读区域, 保证生产者复用时提交字为 0
+                memset(p, 0, len);
+                header_->tail.store(tail + len, std::memory_order_release);
+                NotifyProducers();
+                continue;
+            }
+            *record = Slice(p + sizeof(uint64_t), len);
+            return true;
+        }
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::Peek(Slice * record) {
+        WaitUntil(&header_->data_seq, &header_->data_waiters, [this, record]() {
+            return TryPeek(record);
+        });
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::Consume() {
+        uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        uint64_t word = WordAt(tail)->load(std::memory_order_relaxed);
+        assert((word & kCommitted) != 0 && (word & kPadding) == 0);
+        size_t span = sizeof(uint64_t) + Align8(static_cast<size_t>(word >> 2));
+        memset(data_ + (tail & (capacity_ - 1)), 0, span);
+        header_->tail.store(tail + span, std::memory_order_release);
+        NotifyProducers();
+    }
+
+    template<bool kMultiProducer>
+    bool BasicRingBuffer<kMultiProducer>::TryPop(std::string * record) {
+        Slice s;
+        if (!TryPeek(&s)) {
+            return false;
+        }
+        record->assign(s.data(), s.size());
+        Consume();
+        return true;
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::Pop(std::string * record) {
+        Slice s;
+        Peek(&s);
+        record->assign(s.data(), s.size());
+        Consume();
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::NotifyConsumer() {
+        Notify(&header_->data_seq, &header_->data_waiters);
+    }
+
+    template<bool kMultiProducer>
+    void BasicRingBuffer<kMultiProducer>::NotifyProducers() {
+        Notify(&header_->space_seq, &header_->space_waiters);
+    }
+
+    template
+    class BasicRingBuffer<false>;
+
+    template
+    class BasicRingBuffer<true>;
+}
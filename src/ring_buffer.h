@@ -0,0 +1,102 @@
+#pragma once
+#ifndef POSIX_ENV_RING_BUFFER_H
+#define POSIX_ENV_RING_BUFFER_H
+
+/*
+ * 以 MmapFile 为存储的跨进程无锁环形缓冲
+ * SpscRingBuffer: 单生产者单消费者
+ * MpscRingBuffer: 多生产者单消费者
+ *
+ * 记录为变长字节串, 头部为 8 字节提交字, 生产者写完数据后再提交
+ * 队列空/满时通过 futex 等待, 进程间共享同一份映射即可通信
+ * 注意: 生产者在提交前崩溃会使消费者永久阻塞
+ */
+
+#include <atomic>
+#include <cstdint>
+
+#include "env.h"
+
+namespace penv {
+    struct RingBufferHeader {
+        alignas(64) uint64_t magic;
+        uint64_t capacity;
+        uint64_t multi_producer;
+
+        // 生产者预留位置
+        alignas(64) std::atomic<uint64_t> head;
+        // 消费者位置
+        alignas(64) std::atomic<uint64_t> tail;
+
+        alignas(64) std::atomic<uint32_t> data_seq;
+        std::atomic<uint32_t> data_waiters;
+
+        alignas(64) std::atomic<uint32_t> space_seq;
+        std::atomic<uint32_t> space_waiters;
+    };
+
+    template<bool kMultiProducer>
+    class BasicRingBuffer {
+    public:
+        enum {
+            kHeaderSize = 4096
+        };
+
+    private:
+        static_assert(sizeof(RingBufferHeader) <= kHeaderSize);
+        static_assert(std::atomic<uint64_t>::is_always_lock_free);
+        static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+        // 缓存了 Base() 指针, 每次操作通过 Touch 声明访问
+        MmapFile * file_;
+        RingBufferHeader * header_;
+        char * data_;
+        size_t capacity_;
+
+    public:
+        // 在 file 上建立容量为 capacity(2 的幂)的空队列, 会 Resize file
+        static void Init(MmapFile * file, size_t capacity);
+
+        // 挂载已 Init 的队列, file 生命周期内不可再 Resize
+        explicit BasicRingBuffer(MmapFile * file);
+
+    public:
+        size_t Capacity() const {
+            return capacity_;
+        }
+
+        // 单条记录最多占用一半容量
+        size_t MaxRecordSize() const {
+            return capacity_ / 2 - sizeof(uint64_t);
+        }
+
+        bool TryPush(const Slice & record);
+
+        void Push(const Slice & record);
+
+        // 零拷贝读取, record 在 Consume 前有效, 仅消费者调用
+        bool TryPeek(Slice * record);
+
+        void Peek(Slice * record);
+
+        void Consume();
+
+        bool TryPop(std::string * record);
+
+        void Pop(std::string * record);
+
+    private:
+        std::atomic<uint64_t> * WordAt(uint64_t pos) const {
+            return reinterpret_cast<std::atomic<uint64_t> *>(data_ + (pos & (capacity_ - 1)));
+        }
+
+        void NotifyConsumer();
+
+        void NotifyProducers();
+    };
+
+    using SpscRingBuffer = BasicRingBuffer<false>;
+    using MpscRingBuffer = BasicRingBuffer<true>;
+}
+
+#endif //POSIX_ENV_RING_BUFFER_H
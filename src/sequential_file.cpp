@@ -1,4 +1,5 @@
 #include <cerrno>
+#include <stdexcept>
 
 #include "defs.h"
 #include "sequential_file.h"
@@ -11,17 +12,27 @@ namespace penv {
     }
 
     void PosixSequentialFile::Read(size_t n, char * scratch) {
+        size_t bytes_read;
+        Status s = TryRead(n, scratch, &bytes_read);
+        if (!s.ok()) {
+            throw s.ToException(fname_);
+        }
+    }
+
+    Status PosixSequentialFile::TryRead(size_t n, char * scratch, size_t * bytes_read) noexcept {
         size_t r = 0;
         do {
             r = fread_unlocked(scratch, 1, n, file_);
         } while (r == 0 && ferror(file_) && errno == EINTR);
+        *bytes_read = r;
         if (r < n) {
             if (feof(file_)) {
                 clearerr(file_);
             } else {
-                throw IO_EXCEPTION(fname_);
+                return PENV_STATUS(errno);
             }
         }
+        return Status();
     }
 
     void PosixSequentialFile::Skip(size_t n) {
@@ -21,6 +21,8 @@ namespace penv {
         void Read(size_t n, char * scratch) override;
 
         void Skip(size_t n) override;
+
+        Status TryRead(size_t n, char * scratch, size_t * bytes_read) noexcept override;
     };
 }
 
@@ -0,0 +1,101 @@
+#pragma once
+#ifndef POSIX_ENV_STATUS_H
+#define POSIX_ENV_STATUS_H
+
+/*
+ * Try* 系列接口的返回值
+ * 只保存错误码与出错位置, 成功与失败都不分配内存, 描述在 ToString 时才拼接
+ * 用于预期会失败的热路径(探测文件是否存在、读到末尾), 其余场合仍使用异常
+ * 内存不足(std::bad_alloc)同样以 ENOMEM 返回, 不会穿过 noexcept
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+namespace penv {
+    class Status {
+    private:
+        int code_;
+        const char * func_;
+        int line_;
+
+    public:
+        // 非 errno 的错误码
+        enum {
+            kEndOfFile = -1,
+            // 默认实现捕获到的异常没有对应的 errno
+            kUnknown = -2
+        };
+
+        Status() noexcept
+                : code_(0),
+                  func_(nullptr),
+                  line_(0) {}
+
+        Status(int code, const char * func, int line) noexcept
+                : code_(code),
+                  func_(func),
+                  line_(line) {}
+
+    public:
+        bool ok() const noexcept {
+            return code_ == 0;
+        }
+
+        // 成功为 0, 系统调用失败时为 errno
+        int code() const noexcept {
+            return code_;
+        }
+
+        bool IsNotFound() const noexcept {
+            return code_ == ENOENT;
+        }
+
+        bool IsEndOfFile() const noexcept {
+            return code_ == kEndOfFile;
+        }
+
+        // 格式与 IO 异常一致, context 一般为文件名
+        std::string ToString(const std::string & context = std::string()) const {
+            if (ok()) {
+                return "OK";
+            }
+            std::string msg = "IO:" + std::string(func_) + " at line " + std::to_string(line_) + " | ";
+            if (code_ == kEndOfFile) {
+                msg += "end of file";
+            } else if (code_ == kUnknown) {
+                msg += "unknown error";
+            } else {
+                msg += strerror(code_);
+            }
+            return msg + " | " + context;
+        }
+
+        std::runtime_error ToException(const std::string & context) const {
+            return std::runtime_error(ToString(context));
+        }
+    };
+
+    // 执行抛异常的版本并转换为 Status, 供 Try* 的默认实现使用
+    template<typename F>
+    inline Status CatchStatus(const char * func, int line, F && f) noexcept {
+        errno = 0;
+        try {
+            f();
+            return Status();
+        } catch (const std::bad_alloc &) {
+            return Status(ENOMEM, func, line);
+        } catch (...) {
+            int code = errno;
+            return Status(code != 0 ? code : Status::kUnknown, func, line);
+        }
+    }
+}
+
+#define PENV_STATUS(code) ::penv::Status((code), __PRETTY_FUNCTION__, __LINE__)
+#define PENV_CATCH_STATUS(f) ::penv::CatchStatus(__PRETTY_FUNCTION__, __LINE__, (f))
+
+#endif //POSIX_ENV_STATUS_H
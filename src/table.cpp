@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "coding.h"
+#include "defs.h"
+#include "hash.h"
+#include "table.h"
+
+#define TABLE_EXCEPTION(msg) std::runtime_error("Table:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr uint64_t kTableMagic = 0x4c4254564e4550ULL; // "PENVTBL"
+        constexpr size_t kFooterSize = 6 * sizeof(uint64_t);
+
+        void EncodeHandle(std::string * dst, const BlockHandle & handle) {
+            PutVarint64(dst, handle.offset);
+            PutVarint64(dst, handle.size);
+        }
+
+        BlockHandle DecodeHandle(const Slice & src) {
+            BlockHandle handle;
+            const char * p = GetVarint64(src.data(), src.data() + src.size(), &handle.offset);
+            if (p == nullptr || GetVarint64(p, src.data() + src.size(), &handle.size) == nullptr) {
+                throw TABLE_EXCEPTION("corrupted block handle");
+            }
+            return handle;
+        }
+
+        // 与 LevelDB 相同的 double hashing
+        template<typename Visit>
+        void BloomProbe(uint64_t h, size_t bits, int k, Visit && visit) {
+            uint64_t delta = (h >> 33) | (h << 31);
+            for (int i = 0; i < k; ++i) {
+                if (!visit(static_cast<size_t>(h % bits))) {
+                    return;
+                }
+                h += delta;
+            }
+        }
+    }
+
+    TableBuilder::BlockBuilder::BlockBuilder(int restart_interval)
+            : restarts_{0},
+              counter_(0),
+              restart_interval_(restart_interval) {}
+
+    void TableBuilder::BlockBuilder::Add(const Slice & key, const Slice & value) {
+        size_t shared = 0;
+        if (counter_ < restart_interval_) {
+            size_t min_length = std::min(last_key_.size(), key.size());
+            while (shared < min_length && last_key_[shared] == key[shared]) {
+                ++shared;
+            }
+        } else {
+            restarts_.emplace_back(static_cast<uint32_t>(buffer_.size()));
+            counter_ = 0;
+        }
+        PutVarint32(&buffer_, static_cast<uint32_t>(shared));
+        PutVarint32(&buffer_, static_cast<uint32_t>(key.size() - shared));
+        PutVarint32(&buffer_, static_cast<uint32_t>(value.size()));
+        buffer_.append(key.data() + shared, key.size() - shared);
+        buffer_.append(value.data(), value.size());
+
+        last_key_.assign(key.data(), key.size());
+        ++counter_;
+    }
+
+    Slice TableBuilder::BlockBuilder::Finish() {
+        for (uint32_t restart : restarts_) {
+            PutFixed32(&buffer_, restart);
+        }
+        PutFixed32(&buffer_, static_cast<uint32_t>(restarts_.size()));
+        return buffer_;
+    }
+
+    void TableBuilder::BlockBuilder::Reset() {
+        buffer_.clear();
+        restarts_.assign(1, 0);
+        counter_ = 0;
+        last_key_.clear();
+    }
+
+    TableBuilder::TableBuilder(WritableFile * file, const TableOptions & options)
+            : file_(file),
+              options_(options),
+              data_block_(options.restart_interval),
+              index_partition_(1),
+              top_index_(1),
+              offset_(0),
+              num_entries_(0),
+              finished_(false) {}
+
+    void TableBuilder::Add(const Slice & key, const Slice & value) {
+        assert(!finished_);
+        if (num_entries_ != 0 && SliceCmp(key, last_key_) <= 0) {
+            throw TABLE_EXCEPTION("keys must be added in strictly increasing order");
+        }
+        data_block_.Add(key, value);
+        key_hashes_.emplace_back(Hash64(key));
+        last_key_.assign(key.data(), key.size());
+        ++num_entries_;
+
+        if (data_block_.EstimatedSize() >= options_.block_size) {
+            FlushDataBlock();
+        }
+    }
+
+    void TableBuilder::Finish() {
+        assert(!finished_);
+        FlushDataBlock();
+        FlushIndexPartition();
+        BlockHandle top_handle = WriteBlock(top_index_.Finish());
+
+        std::string filter;
+        int k = 0;
+        if (options_.bloom_bits_per_key > 0) {
+            size_t bits = std::max<size_t>(key_hashes_.size() * options_.bloom_bits_per_key, 64);
+            bits = (bits + 7) / 8 * 8;
+            // k = ln2 * bits_per_key
+            k = std::min(std::max(static_cast<int>(options_.bloom_bits_per_key * 0.69), 1), 30);
+            filter.resize(bits / 8);
+            for (uint64_t h : key_hashes_) {
+                BloomProbe(h, bits, k, [&filter](size_t bitpos) {
+                    filter[bitpos / 8] |= static_cast<char>(1 << (bitpos % 8));
+                    return true;
+                });
+            }
+        }
+        filter.push_back(static_cast<char>(k));
+        BlockHandle filter_handle = WriteBlock(filter);
+
+        std::string footer;
+        PutFixed64(&footer, top_handle.offset);
+        PutFixed64(&footer, top_handle.size);
+        PutFixed64(&footer, filter_handle.offset);
+        PutFixed64(&footer, filter_handle.size);
+        PutFixed64(&footer, num_entries_);
+        PutFixed64(&footer, kTableMagic);
+        WriteBlock(footer);
+
+        key_hashes_.clear();
+        key_hashes_.shrink_to_fit();
+        finished_ = true;
+    }
+
+    void TableBuilder::FlushDataBlock() {
+        if (data_block_.Empty()) {
+            return;
+        }
+        BlockHandle handle = WriteBlock(data_block_.Finish());
+        std::string encoded;
+        EncodeHandle(&encoded, handle);
+        index_partition_.Add(data_block_.LastKey(), encoded);
+        data_block_.Reset();
+
+        if (index_partition_.EstimatedSize() >= options_.index_partition_size) {
+            FlushIndexPartition();
+        }
+    }
+
+    void TableBuilder::FlushIndexPartition() {
+        if (index_partition_.Empty()) {
+            return;
+        }
+        BlockHandle handle = WriteBlock(index_partition_.Finish());
+        std::string encoded;
+        EncodeHandle(&encoded, handle);
+        top_index_.Add(index_partition_.LastKey(), encoded);
+        index_partition_.Reset();
+    }
+
+    BlockHandle TableBuilder::WriteBlock(const Slice & contents) {
+        BlockHandle handle;
+        handle.offset = offset_;
+        handle.size = contents.size();
+        file_->Write(contents);
+        offset_ += contents.size();
+        return handle;
+    }
+
+    TableReader::TableReader(RandomAccessFile * file, size_t file_size)
+            : file_(file) {
+        if (file_size < kFooterSize) {
+            throw TABLE_EXCEPTION("file too small");
+        }
+        char footer[kFooterSize];
+        file_->ReadAt(file_size - kFooterSize, kFooterSize, footer);
+        if (DecodeFixed64(footer + 40) != kTableMagic) {
+            throw TABLE_EXCEPTION("bad table magic");
+        }
+        BlockHandle top_handle{DecodeFixed64(footer), DecodeFixed64(footer + 8)};
+        BlockHandle filter_handle{DecodeFixed64(footer + 16), DecodeFixed64(footer + 24)};
+        num_entries_ = DecodeFixed64(footer + 32);
+
+        std::string top_index = ReadBlock(top_handle);
+        BlockIterator iter(top_index);
+        for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+            top_keys_.emplace_back(iter.key().ToString());
+            top_handles_.emplace_back(DecodeHandle(iter.value()));
+        }
+        partitions_.resize(top_handles_.size());
+        filter_ = ReadBlock(filter_handle);
+    }
+
+    bool TableReader::Get(const Slice & key, std::string * value) const {
+        if (!KeyMayMatch(key)) {
+            return false;
+        }
+        size_t index = FindPartition(key);
+        if (index == top_handles_.size()) {
+            return false;
+        }
+
+        std::shared_ptr<const std::string> partition = ReadPartition(index);
+        BlockIterator partition_iter(*partition);
+        partition_iter.Seek(key);
+        if (!partition_iter.Valid()) {
+            return false;
+        }
+
+        std::string block = ReadBlock(DecodeHandle(partition_iter.value()));
+        BlockIterator iter(block);
+        iter.Seek(key);
+        if (!iter.Valid() || iter.key() != key) {
+            return false;
+        }
+        value->assign(iter.value().data(), iter.value().size());
+        return true;
+    }
+
+    std::unique_ptr<TableIterator> TableReader::NewIterator() const {
+        return std::make_unique<TableIterator>(this);
+    }
+
+    bool TableReader::KeyMayMatch(const Slice & key) const {
+        if (filter_.size() < 2) {
+            return true;
+        }
+        int k = filter_.back();
+        if (k <= 0 || k > 30) {
+            return true;
+        }
+        size_t bits = (filter_.size() - 1) * 8;
+        bool match = true;
+        BloomProbe(Hash64(key), bits, k, [this, &match](size_t bitpos) {
+            match = (filter_[bitpos / 8] & (1 << (bitpos % 8))) != 0;
+            return match;
+        });
+        return match;
+    }
+
+    std::shared_ptr<const std::string> TableReader::ReadPartition(size_t index) const {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (partitions_[index] != nullptr) {
+                return partitions_[index];
+            }
+        }
+        auto partition = std::make_shared<const std::string>(ReadBlock(top_handles_[index]));
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (partitions_[index] == nullptr) {
+            partitions_[index] = partition;
+        }
+        return partitions_[index];
+    }
+
+    size_t TableReader::FindPartition(const Slice & target) const {
+        auto it = std::lower_bound(top_keys_.begin(), top_keys_.end(), target, SliceComparator());
+        return static_cast<size_t>(it - top_keys_.begin());
+    }
+
+    std::string TableReader::ReadBlock(const BlockHandle & handle) const {
+        std::string block(handle.size, '\0');
+        file_->ReadAt(handle.offset, handle.size, &block[0]);
+        return block;
+    }
+
+    BlockIterator::BlockIterator(const Slice & contents)
+            : data_(contents.data()),
+              restarts_offset_(0),
+              num_restarts_(0),
+              current_(0),
+              next_(0) {
+        if (contents.size() < sizeof(uint32_t)) {
+            throw TABLE_EXCEPTION("corrupted block");
+        }
+        num_restarts_ = DecodeFixed32(data_ + contents.size() - sizeof(uint32_t));
+        if ((contents.size() - sizeof(uint32_t)) / sizeof(uint32_t) < num_restarts_) {
+            throw TABLE_EXCEPTION("corrupted block");
+        }
+        restarts_offset_ = contents.size() - (num_restarts_ + 1) * sizeof(uint32_t);
+        current_ = restarts_offset_;
+        next_ = restarts_offset_;
+    }
+
+    void BlockIterator::SeekToFirst() {
+        if (num_restarts_ == 0) {
+            current_ = restarts_offset_;
+            return;
+        }
+        SeekToRestartPoint(0);
+        ParseNextEntry();
+    }
+
+    void BlockIterator::Seek(const Slice & target) {
+        if (num_restarts_ == 0) {
+            current_ = restarts_offset_;
+            return;
+        }
+        // 二分找到最后一个 key < target 的 restart 点, 再线性扫描
+        uint32_t left = 0;
+        uint32_t right = num_restarts_ - 1;
+        while (left < right) {
+            uint32_t mid = (left + right + 1) / 2;
+            SeekToRestartPoint(mid);
+            if (!ParseNextEntry()) {
+                throw TABLE_EXCEPTION("corrupted block");
+            }
+            if (SliceCmp(key_, target) < 0) {
+                left = mid;
+            } else {
+                right = mid - 1;
+            }
+        }
+        SeekToRestartPoint(left);
+        while (ParseNextEntry()) {
+            if (SliceCmp(key_, target) >= 0) {
+                return;
+            }
+        }
+    }
+
+    void BlockIterator::Next() {
+        assert(Valid());
+        ParseNextEntry();
+    }
+
+    uint32_t BlockIterator::RestartPoint(uint32_t index) const {
+        return DecodeFixed32(data_ + restarts_offset_ + index * sizeof(uint32_t));
+    }
+
+    void BlockIterator::SeekToRestartPoint(uint32_t index) {
+        key_.clear();
+        next_ = RestartPoint(index);
+    }
+
+    bool BlockIterator::ParseNextEntry() {
+        current_ = next_;
+        if (current_ >= restarts_offset_) {
+            current_ = restarts_offset_;
+            return false;
+        }
+        const char * p = data_ + current_;
+        const char * limit = data_ + restarts_offset_;
+        uint32_t shared, non_shared, value_size;
+        if ((p = GetVarint32(p, limit, &shared)) == nullptr ||
+            (p = GetVarint32(p, limit, &non_shared)) == nullptr ||
+            (p = GetVarint32(p, limit, &value_size)) == nullptr ||
+            static_cast<size_t>(limit - p) < static_cast<size_t>(non_shared) + value_size ||
+            key_.size() < shared) {
+            throw TABLE_EXCEPTION("corrupted block");
+        }
+        key_.resize(shared);
+        key_.append(p, non_shared);
+        value_ = Slice(p + non_shared, value_size);
+        next_ = static_cast<size_t>(p + non_shared + value_size - data_);
+        return true;
+    }
+
+    TableIterator::TableIterator(const TableReader * table)
+            : table_(table),
+              partition_index_(0) {}
+
+    void TableIterator::SeekToFirst() {
+        partition_index_ = 0;
+        data_iter_ = BlockIterator();
+        if (partition_index_ >= table_->top_handles_.size()) {
+            return;
+        }
+        LoadPartition();
+        partition_iter_.SeekToFirst();
+        if (partition_iter_.Valid()) {
+            LoadDataBlock();
+            data_iter_.SeekToFirst();
+        }
+        SkipEmptyForward();
+    }
+
+    void TableIterator::Seek(const Slice & target) {
+        partition_index_ = table_->FindPartition(target);
+        data_iter_ = BlockIterator();
+        if (partition_index_ >= table_->top_handles_.size()) {
+            return;
+        }
+        LoadPartition();
+        partition_iter_.Seek(target);
+        if (partition_iter_.Valid()) {
+            LoadDataBlock();
+            data_iter_.Seek(target);
+        }
+        SkipEmptyForward();
+    }
+
+    void TableIterator::Next() {
+        data_iter_.Next();
+        SkipEmptyForward();
+    }
+
+    void TableIterator::LoadPartition() {
+        partition_ = table_->ReadPartition(partition_index_);
+        partition_iter_ = BlockIterator(*partition_);
+    }
+
+    void TableIterator::LoadDataBlock() {
+        data_block_ = table_->ReadBlock(DecodeHandle(partition_iter_.value()));
+        data_iter_ = BlockIterator(data_block_);
+    }
+
+    void TableIterator::SkipEmptyForward() {
+        while (!data_iter_.Valid()) {
+            if (partition_iter_.Valid()) {
+                partition_iter_.Next();
+            }
+            while (!partition_iter_.Valid()) {
+                if (++partition_index_ >= table_->top_handles_.size()) {
+                    data_iter_ = BlockIterator();
+                    return;
+                }
+                LoadPartition();
+                partition_iter_.SeekToFirst();
+            }
+            LoadDataBlock();
+            data_iter_.SeekToFirst();
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+#ifndef POSIX_ENV_TABLE_H
+#define POSIX_ENV_TABLE_H
+
+/*
+ * 不可变有序 KV 表
+ *
+ * 文件布局:
+ * [data block]...[index partition]...[top index][bloom filter][footer]
+ *
+ * data block 与 index block 均为前缀压缩 + restart 点的格式
+ * 二级索引: top index -> index partition -> data block, 索引 key 为块内最大 key
+ * footer 定长, 记录 top index 与 bloom filter 的位置
+ *
+ * 点查在 bloom 过滤后最多读一次 data block(index partition 首次读取后常驻)
+ */
+
+#include <mutex>
+#include <vector>
+
+#include "env.h"
+
+namespace penv {
+    struct TableOptions {
+        size_t block_size = 4096;
+        size_t index_partition_size = 4096;
+        int restart_interval = 16;
+        int bloom_bits_per_key = 10;
+    };
+
+    struct BlockHandle {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    class TableBuilder {
+    private:
+        class BlockBuilder {
+        private:
+            std::string buffer_;
+            std::vector<uint32_t> restarts_;
+            std::string last_key_;
+            int counter_;
+            int restart_interval_;
+
+        public:
+            explicit BlockBuilder(int restart_interval);
+
+        public:
+            void Add(const Slice & key, const Slice & value);
+
+            // 返回块内容, 之后需 Reset 才能复用
+            Slice Finish();
+
+            void Reset();
+
+            size_t EstimatedSize() const {
+                return buffer_.size() + (restarts_.size() + 1) * sizeof(uint32_t);
+            }
+
+            bool Empty() const {
+                return buffer_.empty();
+            }
+
+            const std::string & LastKey() const {
+                return last_key_;
+            }
+        };
+
+        WritableFile * file_;
+        TableOptions options_;
+        BlockBuilder data_block_;
+        BlockBuilder index_partition_;
+        BlockBuilder top_index_;
+        std::vector<uint64_t> key_hashes_;
+        std::string last_key_;
+        uint64_t offset_;
+        uint64_t num_entries_;
+        bool finished_;
+
+    public:
+        explicit TableBuilder(WritableFile * file, const TableOptions & options = TableOptions());
+
+    public:
+        // key 必须严格递增(SliceComparator 序)
+        void Add(const Slice & key, const Slice & value);
+
+        // 写出剩余块, 索引, 过滤器与 footer, 不做 Sync
+        void Finish();
+
+        uint64_t NumEntries() const {
+            return num_entries_;
+        }
+
+        uint64_t FileSize() const {
+            return offset_;
+        }
+
+    private:
+        void FlushDataBlock();
+
+        void FlushIndexPartition();
+
+        BlockHandle WriteBlock(const Slice & contents);
+    };
+
+    class TableIterator;
+
+    class TableReader {
+    private:
+        friend class TableIterator;
+
+        RandomAccessFile * file_;
+        // top index 打开时解码常驻
+        std::vector<std::string> top_keys_;
+        std::vector<BlockHandle> top_handles_;
+        std::string filter_;
+        uint64_t num_entries_;
+
+        // index partition 按需读取后常驻, 下标与 top index 中的顺序一致
+        mutable std::mutex mutex_;
+        mutable std::vector<std::shared_ptr<const std::string>> partitions_;
+
+    public:
+        // file 生命周期需长于 TableReader
+        TableReader(RandomAccessFile * file, size_t file_size);
+
+    public:
+        bool Get(const Slice & key, std::string * value) const;
+
+        std::unique_ptr<TableIterator> NewIterator() const;
+
+        uint64_t NumEntries() const {
+            return num_entries_;
+        }
+
+    private:
+        bool KeyMayMatch(const Slice & key) const;
+
+        std::shared_ptr<const std::string> ReadPartition(size_t index) const;
+
+        // 第一个 key >= target 的 partition 下标
+        size_t FindPartition(const Slice & target) const;
+
+        std::string ReadBlock(const BlockHandle & handle) const;
+    };
+
+    class BlockIterator {
+    private:
+        const char * data_;
+        size_t restarts_offset_;
+        uint32_t num_restarts_;
+
+        size_t current_;
+        size_t next_;
+        std::string key_;
+        Slice value_;
+
+    public:
+        BlockIterator() : data_(nullptr), restarts_offset_(0), num_restarts_(0), current_(0), next_(0) {}
+
+        // contents 生命周期需长于迭代器
+        explicit BlockIterator(const Slice & contents);
+
+    public:
+        bool Valid() const {
+            return current_ < restarts_offset_;
+        }
+
+        void SeekToFirst();
+
+        // 定位到第一个 >= target 的 key
+        void Seek(const Slice & target);
+
+        void Next();
+
+        Slice key() const {
+            return key_;
+        }
+
+        Slice value() const {
+            return value_;
+        }
+
+    private:
+        uint32_t RestartPoint(uint32_t index) const;
+
+        void SeekToRestartPoint(uint32_t index);
+
+        bool ParseNextEntry();
+    };
+
+    class TableIterator {
+    private:
+        const TableReader * table_;
+        size_t partition_index_;
+        std::shared_ptr<const std::string> partition_;
+        BlockIterator partition_iter_;
+        std::string data_block_;
+        BlockIterator data_iter_;
+
+    public:
+        explicit TableIterator(const TableReader * table);
+
+    public:
+        bool Valid() const {
+            return data_iter_.Valid();
+        }
+
+        void SeekToFirst();
+
+        void Seek(const Slice & target);
+
+        void Next();
+
+        Slice key() const {
+            return data_iter_.key();
+        }
+
+        Slice value() const {
+            return data_iter_.value();
+        }
+
+    private:
+        void LoadPartition();
+
+        void LoadDataBlock();
+
+        void SkipEmptyForward();
+    };
+}
+
+#endif //POSIX_ENV_TABLE_H
@@ -0,0 +1,923 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include "defs.h"
+#include "trace_env.h"
+
+#define TRACE_EXCEPTION(msg) std::runtime_error("Trace:" + PENV_EXCEPTION_INFO + " | " + (msg))
+
+namespace penv {
+    namespace {
+        constexpr uint64_t kTraceMagic = 0x31435254564e4550; // "PENVTRC1"
+
+        uint32_t ThreadNumber() {
+            static std::atomic<uint32_t> next(0);
+            thread_local uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+            return number;
+        }
+
+        // 析构时记录, 异常退出的操作同样会被记录并标记为失败
+        class TraceScope {
+        private:
+            TraceEnv * env_;
+            TraceOp op_;
+            uint32_t handle_;
+            size_t offset_;
+            size_t size_;
+            Slice name_;
+            uint8_t arg_;
+            uint64_t begin_;
+            int exceptions_;
+            bool failed_;
+
+        public:
+            TraceScope(TraceEnv * env, TraceOp op, uint32_t handle, size_t offset, size_t size,
+                       const Slice & name = Slice(), uint8_t arg = 0)
+                    : env_(env),
+                      op_(op),
+                      handle_(handle),
+                      offset_(offset),
+                      size_(size),
+                      name_(name),
+                      arg_(arg),
+                      begin_(TraceEnv::NowNanos()),
+                      exceptions_(std::uncaught_exceptions()),
+                      failed_(false) {}
+
+            ~TraceScope() {
+                env_->Record(op_, handle_, begin_, offset_, size_, name_, arg_,
+                             failed_ || std::uncaught_exceptions() > exceptions_);
+            }
+
+            // Try* 接口不抛异常, 由返回值标记失败
+            Status Check(Status s) {
+                failed_ = !s.ok();
+                return s;
+            }
+        };
+
+        template<typename T>
+        T * Require(const std::unique_ptr<T> & file) {
+            if (file == nullptr) {
+                throw TRACE_EXCEPTION("no such handle");
+            }
+            return file.get();
+        }
+
+        class TraceSequentialFile : public SequentialFile {
+        private:
+            std::unique_ptr<SequentialFile> file_;
+            TraceEnv * env_;
+            uint32_t handle_;
+
+        public:
+            TraceSequentialFile(std::unique_ptr<SequentialFile> file, TraceEnv * env, uint32_t handle)
+                    : file_(std::move(file)),
+                      env_(env),
+                      handle_(handle) {}
+
+            ~TraceSequentialFile() override {
+                TraceScope scope(env_, kTraceClose, handle_, 0, 0);
+                file_.reset();
+            }
+
+        public:
+            void Read(size_t n, char * scratch) override {
+                TraceScope scope(env_, kTraceRead, handle_, 0, n);
+                file_->Read(n, scratch);
+            }
+
+            void Skip(size_t n) override {
+                TraceScope scope(env_, kTraceSkip, handle_, 0, n);
+                file_->Skip(n);
+            }
+
+            Status TryRead(size_t n, char * scratch, size_t * bytes_read) noexcept override {
+                TraceScope scope(env_, kTraceRead, handle_, 0, n);
+                return scope.Check(file_->TryRead(n, scratch, bytes_read));
+            }
+        };
+
+        class TraceRandomAccessFile : public RandomAccessFile {
+        private:
+            std::unique_ptr<RandomAccessFile> file_;
+            TraceEnv * env_;
+            uint32_t handle_;
+
+        public:
+            TraceRandomAccessFile(std::unique_ptr<RandomAccessFile> file, TraceEnv * env, uint32_t handle)
+                    : file_(std::move(file)),
+                      env_(env),
+                      handle_(handle) {}
+
+            ~TraceRandomAccessFile() override {
+                TraceScope scope(env_, kTraceClose, handle_, 0, 0);
+                file_.reset();
+            }
+
+        public:
+            void ReadAt(size_t offset, size_t n, char * scratch) const override {
+                TraceScope scope(env_, kTraceReadAt, handle_, offset, n);
+                file_->ReadAt(offset, n, scratch);
+            }
+
+            Status TryReadAt(size_t offset, size_t n, char * scratch) const noexcept override {
+                TraceScope scope(env_, kTraceReadAt, handle_, offset, n);
+                return scope.Check(file_->TryReadAt(offset, n, scratch));
+            }
+
+            void Prefetch(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTracePrefetch, handle_, offset, n);
+                file_->Prefetch(offset, n);
+            }
+
+            void Hint(AccessPattern hint) override {
+                TraceScope scope(env_, kTraceReadHint, handle_, 0, 0, Slice(), hint);
+                file_->Hint(hint);
+            }
+
+            void RangeHint(size_t offset, size_t n, AccessPattern hint) override {
+                TraceScope scope(env_, kTraceReadRangeHint, handle_, offset, n, Slice(), hint);
+                file_->RangeHint(offset, n, hint);
+            }
+
+            size_t GetResidentSize(size_t offset, size_t n) const override {
+                TraceScope scope(env_, kTraceReadResidency, handle_, offset, n);
+                return file_->GetResidentSize(offset, n);
+            }
+
+            void GetResidentRanges(size_t offset, size_t n,
+                                   std::vector<std::pair<size_t, size_t>> * result) const override {
+                TraceScope scope(env_, kTraceReadResidency, handle_, offset, n);
+                file_->GetResidentRanges(offset, n, result);
+            }
+
+            size_t SeekData(size_t offset) const override {
+                TraceScope scope(env_, kTraceSeekData, handle_, offset, 0);
+                return file_->SeekData(offset);
+            }
+
+            size_t SeekHole(size_t offset) const override {
+                TraceScope scope(env_, kTraceSeekHole, handle_, offset, 0);
+                return file_->SeekHole(offset);
+            }
+        };
+
+        class TraceWritableFile : public WritableFile {
+        private:
+            std::unique_ptr<WritableFile> file_;
+            TraceEnv * env_;
+            uint32_t handle_;
+
+        public:
+            TraceWritableFile(std::unique_ptr<WritableFile> file, TraceEnv * env, uint32_t handle)
+                    : file_(std::move(file)),
+                      env_(env),
+                      handle_(handle) {}
+
+            ~TraceWritableFile() override {
+                TraceScope scope(env_, kTraceClose, handle_, 0, 0);
+                file_.reset();
+            }
+
+            WritableFile * target() const {
+                return file_.get();
+            }
+
+            uint32_t handle() const {
+                return handle_;
+            }
+
+        public:
+            void Write(const Slice & data) override {
+                TraceScope scope(env_, kTraceWrite, handle_, file_->GetFileSize(), data.size());
+                file_->Write(data);
+            }
+
+            void Truncate(size_t n) override {
+                TraceScope scope(env_, kTraceTruncate, handle_, 0, n);
+                file_->Truncate(n);
+            }
+
+            void Sync() override {
+                TraceScope scope(env_, kTraceSync, handle_, 0, 0);
+                file_->Sync();
+            }
+
+            Status TryWrite(const Slice & data) noexcept override {
+                TraceScope scope(env_, kTraceWrite, handle_, file_->GetFileSize(), data.size());
+                return scope.Check(file_->TryWrite(data));
+            }
+
+            Status TrySync() noexcept override {
+                TraceScope scope(env_, kTraceSync, handle_, 0, 0);
+                return scope.Check(file_->TrySync());
+            }
+
+            size_t GetFileSize() const override {
+                return file_->GetFileSize();
+            }
+
+            void Hint(WriteLifeTimeHint hint) override {
+                TraceScope scope(env_, kTraceWriteHint, handle_, 0, 0, Slice(), hint);
+                file_->Hint(hint);
+            }
+
+            void RangeSync(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTraceRangeSync, handle_, offset, n);
+                file_->RangeSync(offset, n);
+            }
+
+            void PrepareWrite(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTracePrepareWrite, handle_, offset, n);
+                file_->PrepareWrite(offset, n);
+            }
+
+            void Allocate(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTraceAllocate, handle_, offset, n);
+                file_->Allocate(offset, n);
+            }
+
+            void PunchHole(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTracePunchHole, handle_, offset, n);
+                file_->PunchHole(offset, n);
+            }
+
+            void CollapseRange(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTraceCollapseRange, handle_, offset, n);
+                file_->CollapseRange(offset, n);
+            }
+
+            void InsertRange(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTraceInsertRange, handle_, offset, n);
+                file_->InsertRange(offset, n);
+            }
+
+            void ZeroRange(size_t offset, size_t n) override {
+                TraceScope scope(env_, kTraceZeroRange, handle_, offset, n);
+                file_->ZeroRange(offset, n);
+            }
+        };
+
+        // 映射内存的读写无法追踪, 只记录系统调用类操作
+        class TraceMmapFile : public MmapFile {
+        private:
+            std::unique_ptr<MmapFile> file_;
+            TraceEnv * env_;
+            uint32_t handle_;
+
+        public:
+            TraceMmapFile(std::unique_ptr<MmapFile> file, TraceEnv * env, uint32_t handle)
+                    : file_(std::move(file)),
+                      env_(env),
+                      handle_(handle) {}
+
+            ~TraceMmapFile() override {
+                TraceScope scope(env_, kTraceClose, handle_, 0, 0);
+                file_.reset();
+            }
+
+        public:
+            void * Base() override {
+                return file_->Base();
+            }
+
+            const void * Base() const override {
+                return file_->Base();
+            }
+
+            // 调用频繁, 不记录
+            void Touch() const override {
+                file_->Touch();
+            }
+
+            size_t GetFileSize() const override {
+                return file_->GetFileSize();
+            }
+
+            void Resize(size_t n) override {
+                TraceScope scope(env_, kTraceMmapResize, handle_, 0, n);
+                file_->Resize(n);
+            }
+
+            void Sync() override {
+                TraceScope scope(env_, kTraceMmapSync, handle_, 0, file_->GetFileSize());
+                file_->Sync();
+            }
+
+            void Hint(AccessPattern hint) override {
+                TraceScope scope(env_, kTraceMmapHint, handle_, 0, 0, Slice(), hint);
+                file_->Hint(hint);
+            }
+
+            void RangeHint(size_t offset, size_t n, AccessPattern hint) override {
+                TraceScope scope(env_, kTraceMmapRangeHint, handle_, offset, n, Slice(), hint);
+                file_->RangeHint(offset, n, hint);
+            }
+
+            size_t GetResidentSize(size_t offset, size_t n) const override {
+                TraceScope scope(env_, kTraceMmapResidency, handle_, offset, n);
+                return file_->GetResidentSize(offset, n);
+            }
+
+            void GetResidentRanges(size_t offset, size_t n,
+                                   std::vector<std::pair<size_t, size_t>> * result) const override {
+                TraceScope scope(env_, kTraceMmapResidency, handle_, offset, n);
+                file_->GetResidentRanges(offset, n, result);
+            }
+        };
+    }
+
+    TraceEnv::TraceEnv(Env * target, std::unique_ptr<WritableFile> trace_file)
+            : target_(target),
+              trace_file_(std::move(trace_file)),
+              broken_(false),
+              next_handle_(1),
+              start_(NowNanos()) {
+        buffer_.reserve(kBufferSize + sizeof(TraceRecord));
+        buffer_.append(reinterpret_cast<const char *>(&kTraceMagic), sizeof(kTraceMagic));
+    }
+
+    TraceEnv::~TraceEnv() {
+        try {
+            Flush();
+        } catch (const std::exception &) {
+        }
+    }
+
+    void TraceEnv::Flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (broken_) {
+            throw TRACE_EXCEPTION("trace file write failed");
+        }
+        if (!buffer_.empty()) {
+            std::string buffer;
+            buffer.swap(buffer_);
+            trace_file_->Write(buffer);
+        }
+    }
+
+    uint64_t TraceEnv::NowNanos() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void TraceEnv::Record(TraceOp op, uint32_t handle, uint64_t begin, size_t offset, size_t size,
+                          const Slice & name, uint8_t arg, bool failed) noexcept {
+        uint64_t end = NowNanos();
+        TraceRecord record = {};
+        record.latency = end - begin;
+        record.offset = offset;
+        record.size = size;
+        record.handle = handle;
+        record.thread = ThreadNumber();
+        record.name_size = static_cast<uint32_t>(name.size());
+        record.op = op;
+        record.arg = arg;
+        record.failed = failed;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        record.timestamp = begin - start_;
+        size_t used = buffer_.size();
+        try {
+            buffer_.append(reinterpret_cast<const char *>(&record), sizeof(record));
+            buffer_.append(name.data(), name.size());
+        } catch (const std::bad_alloc &) {
+            // 丢记录后 trace 不再完整, 与写失败同样处理
+            buffer_.resize(used);
+            broken_ = true;
+            return;
+        }
+        if (buffer_.size() >= kBufferSize) {
+            if (!broken_) {
+                try {
+                    trace_file_->Write(buffer_);
+                } catch (const std::exception &) {
+                    broken_ = true;
+                }
+            }
+            buffer_.clear();
+        }
+    }
+
+    bool TraceEnv::FileExists(const std::string & fname) {
+        TraceScope scope(this, kTraceFileExists, 0, 0, 0, fname);
+        return target_->FileExists(fname);
+    }
+
+    size_t TraceEnv::GetFileSize(const std::string & fname) {
+        TraceScope scope(this, kTraceGetFileSize, 0, 0, 0, fname);
+        return target_->GetFileSize(fname);
+    }
+
+    void TraceEnv::DeleteFile(const std::string & fname) {
+        TraceScope scope(this, kTraceDeleteFile, 0, 0, 0, fname);
+        target_->DeleteFile(fname);
+    }
+
+    Status TraceEnv::TryGetFileSize(const std::string & fname, size_t * size) noexcept {
+        TraceScope scope(this, kTraceGetFileSize, 0, 0, 0, fname);
+        return scope.Check(target_->TryGetFileSize(fname, size));
+    }
+
+    Status TraceEnv::TryDeleteFile(const std::string & fname) noexcept {
+        TraceScope scope(this, kTraceDeleteFile, 0, 0, 0, fname);
+        return scope.Check(target_->TryDeleteFile(fname));
+    }
+
+    void TraceEnv::DeleteAll(const std::string & dirname) {
+        TraceScope scope(this, kTraceDeleteAll, 0, 0, 0, dirname);
+        target_->DeleteAll(dirname);
+    }
+
+    void TraceEnv::GetChildren(const std::string & dirname,
+                               std::vector<std::string> * result) {
+        TraceScope scope(this, kTraceGetChildren, 0, 0, 0, dirname);
+        target_->GetChildren(dirname, result);
+    }
+
+    void TraceEnv::CreateDir(const std::string & dirname) {
+        TraceScope scope(this, kTraceCreateDir, 0, 0, 0, dirname);
+        target_->CreateDir(dirname);
+    }
+
+    std::unique_ptr<SequentialFile>
+    TraceEnv::OpenSequentialFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenSequentialFile, handle, 0, 0, fname);
+        return std::make_unique<TraceSequentialFile>(target_->OpenSequentialFile(fname), this, handle);
+    }
+
+    std::unique_ptr<RandomAccessFile>
+    TraceEnv::OpenRandomAccessFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenRandomAccessFile, handle, 0, 0, fname);
+        return std::make_unique<TraceRandomAccessFile>(target_->OpenRandomAccessFile(fname), this, handle);
+    }
+
+    Status TraceEnv::TryOpenSequentialFile(const std::string & fname,
+                                           std::unique_ptr<SequentialFile> * result) noexcept {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenSequentialFile, handle, 0, 0, fname);
+        std::unique_ptr<SequentialFile> file;
+        Status s = scope.Check(target_->TryOpenSequentialFile(fname, &file));
+        if (s.ok()) {
+            try {
+                *result = std::make_unique<TraceSequentialFile>(std::move(file), this, handle);
+            } catch (const std::bad_alloc &) {
+                return scope.Check(PENV_STATUS(ENOMEM));
+            }
+        }
+        return s;
+    }
+
+    Status TraceEnv::TryOpenRandomAccessFile(const std::string & fname,
+                                             std::unique_ptr<RandomAccessFile> * result) noexcept {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenRandomAccessFile, handle, 0, 0, fname);
+        std::unique_ptr<RandomAccessFile> file;
+        Status s = scope.Check(target_->TryOpenRandomAccessFile(fname, &file));
+        if (s.ok()) {
+            try {
+                *result = std::make_unique<TraceRandomAccessFile>(std::move(file), this, handle);
+            } catch (const std::bad_alloc &) {
+                return scope.Check(PENV_STATUS(ENOMEM));
+            }
+        }
+        return s;
+    }
+
+    Status TraceEnv::TryOpenWritableFile(const std::string & fname,
+                                         std::unique_ptr<WritableFile> * result) noexcept {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenWritableFile, handle, 0, 0, fname);
+        std::unique_ptr<WritableFile> file;
+        Status s = scope.Check(target_->TryOpenWritableFile(fname, &file));
+        if (s.ok()) {
+            try {
+                *result = std::make_unique<TraceWritableFile>(std::move(file), this, handle);
+            } catch (const std::bad_alloc &) {
+                return scope.Check(PENV_STATUS(ENOMEM));
+            }
+        }
+        return s;
+    }
+
+    std::unique_ptr<WritableFile>
+    TraceEnv::OpenWritableFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenWritableFile, handle, 0, 0, fname);
+        return std::make_unique<TraceWritableFile>(target_->OpenWritableFile(fname), this, handle);
+    }
+
+    std::unique_ptr<WritableFile>
+    TraceEnv::ReopenWritableFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceReopenWritableFile, handle, 0, 0, fname);
+        return std::make_unique<TraceWritableFile>(target_->ReopenWritableFile(fname), this, handle);
+    }
+
+    std::unique_ptr<WritableFile>
+    TraceEnv::OpenMmapWritableFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenMmapWritableFile, handle, 0, 0, fname);
+        return std::make_unique<TraceWritableFile>(target_->OpenMmapWritableFile(fname), this, handle);
+    }
+
+    std::unique_ptr<WritableFile>
+    TraceEnv::ReopenMmapWritableFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceReopenMmapWritableFile, handle, 0, 0, fname);
+        return std::make_unique<TraceWritableFile>(target_->ReopenMmapWritableFile(fname), this, handle);
+    }
+
+    std::unique_ptr<WritableFile>
+    TraceEnv::OpenTempWritableFile(const std::string & dirname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenTempWritableFile, handle, 0, 0, dirname);
+        return std::make_unique<TraceWritableFile>(target_->OpenTempWritableFile(dirname), this, handle);
+    }
+
+    void TraceEnv::PublishTempFile(WritableFile * file, const std::string & fname) {
+        auto * trace_file = dynamic_cast<TraceWritableFile *>(file);
+        if (trace_file == nullptr) {
+            throw TRACE_EXCEPTION("file not opened by this env | " + fname);
+        }
+        TraceScope scope(this, kTracePublishTempFile, trace_file->handle(), 0, trace_file->GetFileSize(), fname);
+        target_->PublishTempFile(trace_file->target(), fname);
+    }
+
+    void TraceEnv::SyncDir(const std::string & dirname) {
+        TraceScope scope(this, kTraceSyncDir, 0, 0, 0, dirname);
+        target_->SyncDir(dirname);
+    }
+
+    std::unique_ptr<MmapFile>
+    TraceEnv::OpenMmapFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceOpenMmapFile, handle, 0, 0, fname);
+        return std::make_unique<TraceMmapFile>(target_->OpenMmapFile(fname), this, handle);
+    }
+
+    std::unique_ptr<MmapFile>
+    TraceEnv::ReopenMmapFile(const std::string & fname) {
+        uint32_t handle = NewHandle();
+        TraceScope scope(this, kTraceReopenMmapFile, handle, 0, 0, fname);
+        return std::make_unique<TraceMmapFile>(target_->ReopenMmapFile(fname), this, handle);
+    }
+
+    std::unique_ptr<ExtentIterator>
+    TraceEnv::NewExtentIterator(const std::string & fname) {
+        TraceScope scope(this, kTraceNewExtentIterator, 0, 0, 0, fname);
+        return target_->NewExtentIterator(fname);
+    }
+
+    TraceReplayer::TraceReplayer(Env * env, const std::string & trace_fname)
+            : env_(env) {
+        Env * local = Env::Default();
+        trace_.resize(local->GetFileSize(trace_fname));
+        local->OpenSequentialFile(trace_fname)->Read(trace_.size(), &trace_[0]);
+
+        uint64_t magic = 0;
+        if (trace_.size() >= sizeof(magic)) {
+            memcpy(&magic, trace_.data(), sizeof(magic));
+        }
+        if (magic != kTraceMagic) {
+            throw TRACE_EXCEPTION("bad trace magic | " + trace_fname);
+        }
+    }
+
+    TraceReplayStats TraceReplayer::Replay(const TraceReplayOptions & options) {
+        struct Handle {
+            std::unique_ptr<SequentialFile> sequential;
+            std::unique_ptr<RandomAccessFile> random;
+            std::unique_ptr<WritableFile> writable;
+            std::unique_ptr<MmapFile> mmap;
+        };
+        struct Op {
+            TraceRecord record;
+            std::string name;
+            bool opens = false;
+        };
+        // 句柄可能跨线程使用: 使用前等待打开操作重放完成, 关闭前等待之前的使用全部完成
+        struct HandleState {
+            std::shared_ptr<Handle> handle;
+            bool opened = false;
+            size_t uses = 0;
+            size_t done = 0;
+        };
+        struct Worker {
+            std::vector<Op> ops;
+            std::vector<uint64_t> latencies;
+            double trace_latency_sum = 0;
+            uint64_t trace_end = 0;
+            TraceReplayStats stats;
+        };
+
+        auto rewrite = [&options](std::string name) {
+            if (!options.from_prefix.empty() && name.compare(0, options.from_prefix.size(), options.from_prefix) == 0) {
+                name.replace(0, options.from_prefix.size(), options.to_prefix);
+            }
+            return name;
+        };
+
+        // 按记录的线程分组, 同一线程的记录在 trace 中按完成顺序排列
+        std::unordered_map<uint32_t, size_t> thread_workers;
+        std::vector<Worker> workers;
+        std::unordered_map<uint32_t, HandleState> handles;
+        size_t pos = sizeof(kTraceMagic);
+        while (pos + sizeof(TraceRecord) <= trace_.size()) {
+            Op op;
+            memcpy(&op.record, trace_.data() + pos, sizeof(op.record));
+            pos += sizeof(op.record);
+            if (pos + op.record.name_size > trace_.size()) {
+                break;
+            }
+            op.name = rewrite(trace_.substr(pos, op.record.name_size));
+            pos += op.record.name_size;
+            if (op.record.op >= kTraceOpCount) {
+                throw TRACE_EXCEPTION("bad trace op " + std::to_string(op.record.op));
+            }
+            // 记录在操作完成时写入, 句柄的第一条记录就是打开操作
+            if (op.record.handle != 0) {
+                auto result = handles.emplace(op.record.handle, HandleState());
+                op.opens = result.second;
+                if (!op.opens && op.record.op != kTraceClose) {
+                    ++result.first->second.uses;
+                }
+            }
+            auto it = thread_workers.emplace(op.record.thread, workers.size()).first;
+            if (it->second == workers.size()) {
+                workers.emplace_back();
+            }
+            workers[it->second].ops.emplace_back(std::move(op));
+        }
+
+        // 句柄表的结构在重放前已确定, 重放时只修改其中的状态
+        std::mutex handles_mutex;
+        std::condition_variable handles_cv;
+        auto acquire = [&](const Op & op) {
+            std::unique_lock<std::mutex> lock(handles_mutex);
+            HandleState & state = handles.at(op.record.handle);
+            handles_cv.wait(lock, [&op, &state] {
+                return op.opens || (state.opened && (op.record.op != kTraceClose || state.done == state.uses));
+            });
+            return state.handle;
+        };
+        auto release = [&](const Op & op) {
+            std::shared_ptr<Handle> closed;
+            std::lock_guard<std::mutex> lock(handles_mutex);
+            HandleState & state = handles.at(op.record.handle);
+            if (op.opens) {
+                state.opened = true;
+                handles_cv.notify_all();
+            } else if (op.record.op == kTraceClose) {
+                // 在锁外关闭文件
+                closed = std::move(state.handle);
+            } else if (++state.done == state.uses) {
+                handles_cv.notify_all();
+            }
+        };
+        auto insert = [&](uint32_t handle, auto member, auto file) {
+            auto opened = std::make_shared<Handle>();
+            (*opened).*member = std::move(file);
+            std::lock_guard<std::mutex> lock(handles_mutex);
+            handles.at(handle).handle = std::move(opened);
+        };
+
+        uint64_t start = TraceEnv::NowNanos();
+        auto replay = [&](Worker * worker) {
+            TraceReplayStats & stats = worker->stats;
+            std::string buffer;
+            std::vector<std::string> children;
+            std::vector<std::pair<size_t, size_t>> ranges;
+            const Handle none;
+            for (const Op & op : worker->ops) {
+                const TraceRecord & r = op.record;
+                const std::string & name = op.name;
+                if (!options.fast) {
+                    uint64_t now = TraceEnv::NowNanos() - start;
+                    if (r.timestamp > now) {
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(r.timestamp - now));
+                    }
+                }
+                if ((r.op == kTraceRead || r.op == kTraceReadAt || r.op == kTraceWrite) && buffer.size() < r.size) {
+                    buffer.resize(r.size);
+                }
+
+                std::shared_ptr<Handle> handle = r.handle != 0 ? acquire(op) : nullptr;
+                const Handle & h = handle != nullptr ? *handle : none;
+                uint64_t begin = TraceEnv::NowNanos();
+                try {
+                    switch (r.op) {
+                        case kTraceFileExists:
+                            env_->FileExists(name);
+                            break;
+                        case kTraceGetFileSize:
+                            env_->GetFileSize(name);
+                            break;
+                        case kTraceDeleteFile:
+                            env_->DeleteFile(name);
+                            break;
+                        case kTraceDeleteAll:
+                            env_->DeleteAll(name);
+                            break;
+                        case kTraceGetChildren:
+                            env_->GetChildren(name, &children);
+                            break;
+                        case kTraceCreateDir:
+                            env_->CreateDir(name);
+                            break;
+
+                        case kTraceOpenSequentialFile:
+                            insert(r.handle, &Handle::sequential, env_->OpenSequentialFile(name));
+                            break;
+                        case kTraceOpenRandomAccessFile:
+                            insert(r.handle, &Handle::random, env_->OpenRandomAccessFile(name));
+                            break;
+                        case kTraceOpenWritableFile:
+                            insert(r.handle, &Handle::writable, env_->OpenWritableFile(name));
+                            break;
+                        case kTraceReopenWritableFile:
+                            insert(r.handle, &Handle::writable, env_->ReopenWritableFile(name));
+                            break;
+                        case kTraceOpenMmapWritableFile:
+                            insert(r.handle, &Handle::writable, env_->OpenMmapWritableFile(name));
+                            break;
+                        case kTraceReopenMmapWritableFile:
+                            insert(r.handle, &Handle::writable, env_->ReopenMmapWritableFile(name));
+                            break;
+                        case kTraceOpenMmapFile:
+                            insert(r.handle, &Handle::mmap, env_->OpenMmapFile(name));
+                            break;
+                        case kTraceReopenMmapFile:
+                            insert(r.handle, &Handle::mmap, env_->ReopenMmapFile(name));
+                            break;
+                        case kTraceClose:
+                            // 由 release 关闭
+                            break;
+
+                        case kTraceRead:
+                            Require(h.sequential)->Read(r.size, &buffer[0]);
+                            stats.bytes_read += r.size;
+                            break;
+                        case kTraceSkip:
+                            Require(h.sequential)->Skip(r.size);
+                            break;
+
+                        case kTraceReadAt:
+                            Require(h.random)->ReadAt(r.offset, r.size, &buffer[0]);
+                            stats.bytes_read += r.size;
+                            break;
+                        case kTracePrefetch:
+                            Require(h.random)->Prefetch(r.offset, r.size);
+                            break;
+                        case kTraceReadHint:
+                            Require(h.random)->Hint(static_cast<RandomAccessFile::AccessPattern>(r.arg));
+                            break;
+                        case kTraceReadRangeHint:
+                            Require(h.random)->RangeHint(r.offset, r.size, static_cast<RandomAccessFile::AccessPattern>(r.arg));
+                            break;
+                        case kTraceReadResidency:
+                            Require(h.random)->GetResidentRanges(r.offset, r.size, &ranges);
+                            break;
+
+                        case kTraceWrite:
+                            Require(h.writable)->Write(Slice(buffer.data(), r.size));
+                            stats.bytes_written += r.size;
+                            break;
+                        case kTraceTruncate:
+                            Require(h.writable)->Truncate(r.size);
+                            break;
+                        case kTraceSync:
+                            Require(h.writable)->Sync();
+                            break;
+                        case kTraceWriteHint:
+                            Require(h.writable)->Hint(static_cast<WritableFile::WriteLifeTimeHint>(r.arg));
+                            break;
+                        case kTraceRangeSync:
+                            Require(h.writable)->RangeSync(r.offset, r.size);
+                            break;
+                        case kTracePrepareWrite:
+                            Require(h.writable)->PrepareWrite(r.offset, r.size);
+                            break;
+                        case kTraceAllocate:
+                            Require(h.writable)->Allocate(r.offset, r.size);
+                            break;
+
+                        case kTraceMmapResize:
+                            Require(h.mmap)->Resize(r.size);
+                            break;
+                        case kTraceMmapSync:
+                            Require(h.mmap)->Sync();
+                            break;
+                        case kTraceMmapHint:
+                            Require(h.mmap)->Hint(static_cast<MmapFile::AccessPattern>(r.arg));
+                            break;
+                        case kTraceMmapRangeHint:
+                            Require(h.mmap)->RangeHint(r.offset, r.size, static_cast<MmapFile::AccessPattern>(r.arg));
+                            break;
+                        case kTraceMmapResidency:
+                            Require(h.mmap)->GetResidentRanges(r.offset, r.size, &ranges);
+                            break;
+
+                        case kTraceSeekData:
+                            Require(h.random)->SeekData(r.offset);
+                            break;
+                        case kTraceSeekHole:
+                            Require(h.random)->SeekHole(r.offset);
+                            break;
+                        case kTracePunchHole:
+                            Require(h.writable)->PunchHole(r.offset, r.size);
+                            break;
+                        case kTraceCollapseRange:
+                            Require(h.writable)->CollapseRange(r.offset, r.size);
+                            break;
+                        case kTraceInsertRange:
+                            Require(h.writable)->InsertRange(r.offset, r.size);
+                            break;
+                        case kTraceZeroRange:
+                            Require(h.writable)->ZeroRange(r.offset, r.size);
+                            break;
+                        case kTraceNewExtentIterator: {
+                            // 迭代过程不单独记录, 重放时完整遍历一次
+                            auto iter = env_->NewExtentIterator(name);
+                            while (iter->Valid()) {
+                                iter->Next();
+                            }
+                            break;
+                        }
+
+                        case kTraceOpenTempWritableFile:
+                            insert(r.handle, &Handle::writable, env_->OpenTempWritableFile(name));
+                            break;
+                        case kTracePublishTempFile:
+                            env_->PublishTempFile(Require(h.writable), name);
+                            break;
+                        default:
+                            assert(r.op == kTraceSyncDir);
+                            env_->SyncDir(name);
+                            break;
+                    }
+                } catch (const std::exception &) {
+                    // 原始操作也失败时属预期行为
+                    if (!r.failed) {
+                        ++stats.errors;
+                    }
+                }
+                worker->latencies.emplace_back(TraceEnv::NowNanos() - begin);
+                if (r.handle != 0) {
+                    handle.reset();
+                    release(op);
+                }
+                worker->trace_latency_sum += r.latency;
+                worker->trace_end = std::max<uint64_t>(worker->trace_end, r.timestamp + r.latency);
+            }
+        };
+
+        // 每个原始线程一个工作线程, 保持原始的并发度
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workers.size(); ++i) {
+            threads.emplace_back(replay, &workers[i]);
+        }
+        if (!workers.empty()) {
+            replay(&workers[0]);
+        }
+        for (auto & thread : threads) {
+            thread.join();
+        }
+
+        TraceReplayStats stats;
+        stats.elapsed_nanos = TraceEnv::NowNanos() - start;
+        handles.clear();
+
+        std::vector<uint64_t> latencies;
+        double trace_latency_sum = 0;
+        for (Worker & worker : workers) {
+            stats.errors += worker.stats.errors;
+            stats.bytes_read += worker.stats.bytes_read;
+            stats.bytes_written += worker.stats.bytes_written;
+            stats.trace_elapsed_nanos = std::max(stats.trace_elapsed_nanos, worker.trace_end);
+            trace_latency_sum += worker.trace_latency_sum;
+            latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+        }
+        stats.ops = latencies.size();
+        if (!latencies.empty()) {
+            double sum = 0;
+            for (uint64_t latency : latencies) {
+                sum += latency;
+            }
+            stats.avg_latency = sum / latencies.size();
+            stats.trace_avg_latency = trace_latency_sum / latencies.size();
+            std::sort(latencies.begin(), latencies.end());
+            stats.p50_latency = latencies[latencies.size() / 2];
+            stats.p99_latency = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+            stats.max_latency = latencies.back();
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,238 @@
+#pragma once
+#ifndef POSIX_ENV_TRACE_ENV_H
+#define POSIX_ENV_TRACE_ENV_H
+
+/*
+ * I/O 追踪与回放
+ * TraceEnv 包装任意 Env, 将每次文件操作以定长二进制记录写入 trace 文件
+ * TraceReplayer 将 trace 在任意 Env 上按原速或全速重放, 并统计吞吐与延迟
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "env.h"
+
+namespace penv {
+    enum TraceOp : uint8_t {
+        kTraceFileExists,
+        kTraceGetFileSize,
+        kTraceDeleteFile,
+        kTraceDeleteAll,
+        kTraceGetChildren,
+        kTraceCreateDir,
+
+        kTraceOpenSequentialFile,
+        kTraceOpenRandomAccessFile,
+        kTraceOpenWritableFile,
+        kTraceReopenWritableFile,
+        kTraceOpenMmapWritableFile,
+        kTraceReopenMmapWritableFile,
+        kTraceOpenMmapFile,
+        kTraceReopenMmapFile,
+        kTraceClose,
+
+        kTraceRead,
+        kTraceSkip,
+
+        kTraceReadAt,
+        kTracePrefetch,
+        kTraceReadHint,
+        kTraceReadRangeHint,
+        kTraceReadResidency,
+
+        kTraceWrite,
+        kTraceTruncate,
+        kTraceSync,
+        kTraceWriteHint,
+        kTraceRangeSync,
+        kTracePrepareWrite,
+        kTraceAllocate,
+
+        kTraceMmapResize,
+        kTraceMmapSync,
+        kTraceMmapHint,
+        kTraceMmapRangeHint,
+        kTraceMmapResidency,
+
+        kTraceSeekData,
+        kTraceSeekHole,
+        kTracePunchHole,
+        kTraceCollapseRange,
+        kTraceInsertRange,
+        kTraceZeroRange,
+        kTraceNewExtentIterator,
+
+        kTraceOpenTempWritableFile,
+        kTracePublishTempFile,
+        kTraceSyncDir,
+
+        kTraceOpCount
+    };
+
+    // trace 文件: 8 字节 magic, 之后为若干 TraceRecord, 每条后跟 name_size 字节的文件名
+    struct TraceRecord {
+        uint64_t timestamp; // 距 trace 开始的纳秒数
+        uint64_t latency;   // 纳秒
+        uint64_t offset;
+        uint64_t size;
+        uint32_t handle;    // 打开的文件句柄编号, Env 级操作为 0
+        uint32_t thread;
+        uint32_t name_size;
+        uint8_t op;
+        uint8_t arg;        // hint 等枚举参数
+        uint8_t failed;
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(TraceRecord) == 48);
+
+    class TraceEnv : public Env {
+    private:
+        enum {
+            kBufferSize = 64 * 1024
+        };
+
+        Env * target_;
+        std::unique_ptr<WritableFile> trace_file_;
+        std::mutex mutex_;
+        std::string buffer_;
+        bool broken_;
+        std::atomic<uint32_t> next_handle_;
+        uint64_t start_;
+
+    public:
+        TraceEnv(Env * target, std::unique_ptr<WritableFile> trace_file);
+
+        ~TraceEnv() override;
+
+    public:
+        // 写出缓冲的记录, trace 文件写失败时抛出异常
+        void Flush();
+
+        // 以下供内部包装类使用
+
+        static uint64_t NowNanos();
+
+        uint32_t NewHandle() {
+            return next_handle_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Record(TraceOp op, uint32_t handle, uint64_t begin, size_t offset, size_t size,
+                    const Slice & name = Slice(), uint8_t arg = 0, bool failed = false) noexcept;
+
+    public:
+        bool FileExists(const std::string & fname) override;
+
+        size_t GetFileSize(const std::string & fname) override;
+
+        void DeleteFile(const std::string & fname) override;
+
+        void DeleteAll(const std::string & dirname) override;
+
+        void GetChildren(const std::string & dirname,
+                         std::vector<std::string> * result) override;
+
+        void CreateDir(const std::string & dirname) override;
+
+    public:
+        std::unique_ptr<SequentialFile>
+        OpenSequentialFile(const std::string & fname) override;
+
+        std::unique_ptr<RandomAccessFile>
+        OpenRandomAccessFile(const std::string & fname) override;
+
+        std::unique_ptr<WritableFile>
+        OpenWritableFile(const std::string & fname) override;
+
+        std::unique_ptr<WritableFile>
+        ReopenWritableFile(const std::string & fname) override;
+
+        std::unique_ptr<WritableFile>
+        OpenMmapWritableFile(const std::string & fname) override;
+
+        std::unique_ptr<WritableFile>
+        ReopenMmapWritableFile(const std::string & fname) override;
+
+        std::unique_ptr<WritableFile>
+        OpenTempWritableFile(const std::string & dirname) override;
+
+        void PublishTempFile(WritableFile * file, const std::string & fname) override;
+
+        void SyncDir(const std::string & dirname) override;
+
+        std::unique_ptr<MmapFile>
+        OpenMmapFile(const std::string & fname) override;
+
+        std::unique_ptr<MmapFile>
+        ReopenMmapFile(const std::string & fname) override;
+
+        std::unique_ptr<ExtentIterator>
+        NewExtentIterator(const std::string & fname) override;
+
+    public:
+        // 仅转发, 不记录
+        void SetMmapBudget(size_t budget, MmapBudgetPolicy policy) override {
+            target_->SetMmapBudget(budget, policy);
+        }
+
+        MmapBudgetStats GetMmapBudgetStats() override {
+            return target_->GetMmapBudgetStats();
+        }
+
+    public:
+        // 与对应的抛异常版本记为同一种操作
+        Status TryGetFileSize(const std::string & fname, size_t * size) noexcept override;
+
+        Status TryDeleteFile(const std::string & fname) noexcept override;
+
+        Status TryOpenSequentialFile(const std::string & fname,
+                                     std::unique_ptr<SequentialFile> * result) noexcept override;
+
+        Status TryOpenRandomAccessFile(const std::string & fname,
+                                       std::unique_ptr<RandomAccessFile> * result) noexcept override;
+
+        Status TryOpenWritableFile(const std::string & fname,
+                                   std::unique_ptr<WritableFile> * result) noexcept override;
+    };
+
+    struct TraceReplayOptions {
+        // 全速重放, 否则按记录的时间戳重放
+        bool fast = false;
+        // 文件名前缀替换, 便于重放到其他目录
+        std::string from_prefix;
+        std::string to_prefix;
+    };
+
+    struct TraceReplayStats {
+        size_t ops = 0;
+        size_t errors = 0;
+        size_t bytes_read = 0;
+        size_t bytes_written = 0;
+        uint64_t elapsed_nanos = 0;
+        uint64_t trace_elapsed_nanos = 0;
+        // 重放延迟与原始延迟, 纳秒
+        double avg_latency = 0;
+        double trace_avg_latency = 0;
+        uint64_t p50_latency = 0;
+        uint64_t p99_latency = 0;
+        uint64_t max_latency = 0;
+    };
+
+    // 每个原始线程在独立的工作线程上按序重放, 保持原始的并发度; 跨线程的操作顺序只由时间戳近似保证
+    class TraceReplayer {
+    private:
+        Env * env_;
+        std::string trace_;
+
+    public:
+        TraceReplayer(Env * env, const std::string & trace_fname);
+
+    public:
+        TraceReplayStats Replay(const TraceReplayOptions & options);
+    };
+}
+
+#endif //POSIX_ENV_TRACE_ENV_H
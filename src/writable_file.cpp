@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <fcntl.h>
+#include <stdexcept>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -10,22 +13,62 @@
 
 namespace penv {
     PosixWritableFile::~PosixWritableFile() {
-        if (last_preallocated_block_ > 0) {
-            ftruncate(fd_, static_cast<off_t>(filesize_));
-#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE) && defined(FALLOC_FL_PUNCH_HOLE)
-            struct stat sbuf;
-            int r = fstat(fd_, &sbuf);
-            if (r == 0 &&
-                (sbuf.st_size + sbuf.st_blksize - 1) / sbuf.st_blksize != sbuf.st_blocks / (sbuf.st_blksize / 512)) {
-                fallocate(fd_, FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE, filesize_,
-                          kPreallocationBlockSize * last_preallocated_block_ - filesize_);
+        TrimPreallocation();
+        close(fd_);
+        if (temp_ == kNamedTemp) {
+            unlink(fname_.c_str());
+        }
+    }
+
+    void PosixWritableFile::Publish(const std::string & fname) {
+        TrimPreallocation();
+        if (fdatasync(fd_) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+
+        if (temp_ == kAnonymousTemp) {
+#if defined(PENV_OS_LINUX)
+            std::string proc_path = "/proc/self/fd/" + std::to_string(fd_);
+            int r = linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, fname.c_str(), AT_SYMLINK_FOLLOW);
+            if (r != 0 && errno == EEXIST) {
+                // linkat 不能覆盖, 先链接到同目录下的临时名再 rename
+                static std::atomic<uint64_t> seq(0);
+                std::string tmp = fname + ".penv-tmp-" + std::to_string(getpid()) + "-" +
+                                  std::to_string(seq.fetch_add(1, std::memory_order_relaxed));
+                r = linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, tmp.c_str(), AT_SYMLINK_FOLLOW);
+                if (r == 0) {
+                    r = rename(tmp.c_str(), fname.c_str());
+                    if (r != 0) {
+                        int saved = errno;
+                        unlink(tmp.c_str());
+                        errno = saved;
+                    }
+                }
+            }
+            if (r != 0) {
+                throw IO_EXCEPTION(fname);
             }
+#else
+            errno = EOPNOTSUPP;
+            throw IO_EXCEPTION(fname);
 #endif
+        } else {
+            if (rename(fname_.c_str(), fname.c_str()) != 0) {
+                throw IO_EXCEPTION(fname);
+            }
         }
-        close(fd_);
+        fname_ = fname;
+        temp_ = kNotTemp;
     }
 
     void PosixWritableFile::Write(const Slice & data) {
+        Status s = TryWrite(data);
+        if (!s.ok()) {
+            throw s.ToException(fname_);
+        }
+    }
+
+    Status PosixWritableFile::TryWrite(const Slice & data) noexcept {
         size_t left = data.size();
         const char * src = data.data();
         while (left != 0) {
@@ -34,12 +77,13 @@ namespace penv {
                 if (errno == EINTR) {
                     continue;
                 }
-                throw IO_EXCEPTION(fname_);
+                return PENV_STATUS(errno);
             }
             left -= done;
             src += done;
         }
         filesize_ += data.size();
+        return Status();
     }
 
     void PosixWritableFile::Truncate(size_t n) {
@@ -52,9 +96,17 @@ namespace penv {
     }
 
     void PosixWritableFile::Sync() {
+        Status s = TrySync();
+        if (!s.ok()) {
+            throw s.ToException(fname_);
+        }
+    }
+
+    Status PosixWritableFile::TrySync() noexcept {
         if (fsync(fd_) != 0) {
-            throw IO_EXCEPTION(fname_);
+            return PENV_STATUS(errno);
         }
+        return Status();
     }
 
     void PosixWritableFile::Hint(WriteLifeTimeHint hint) {
@@ -89,4 +141,117 @@ namespace penv {
         }
 #endif
     }
+
+    void PosixWritableFile::PunchHole(size_t offset, size_t n) {
+        if (FallocateRange(fd_, kPunchHole, offset, n) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
+
+    void PosixWritableFile::CollapseRange(size_t offset, size_t n) {
+        if (FallocateRange(fd_, kCollapseRange, offset, n) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        if (offset < filesize_) {
+            filesize_ -= std::min(n, filesize_ - offset);
+        }
+        range_changed_ = true;
+        // 预分配区随之前移, 向上取整以免析构时漏掉截断
+        size_t preallocated = kPreallocationBlockSize * last_preallocated_block_;
+        last_preallocated_block_ = ((preallocated > n ? preallocated - n : 0) + kPreallocationBlockSize - 1) /
+                                   kPreallocationBlockSize;
+        // 非 O_APPEND 时 write 使用文件偏移, 需重新定位到末尾
+        if (lseek(fd_, static_cast<off_t>(filesize_), SEEK_SET) < 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
+
+    void PosixWritableFile::InsertRange(size_t offset, size_t n) {
+        if (FallocateRange(fd_, kInsertRange, offset, n) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+        if (offset < filesize_) {
+            filesize_ += n;
+        }
+        range_changed_ = true;
+        if (last_preallocated_block_ > 0) {
+            last_preallocated_block_ = (kPreallocationBlockSize * last_preallocated_block_ + n +
+                                        kPreallocationBlockSize - 1) / kPreallocationBlockSize;
+        }
+        if (lseek(fd_, static_cast<off_t>(filesize_), SEEK_SET) < 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
+
+    void PosixWritableFile::ZeroRange(size_t offset, size_t n) {
+        if (FallocateRange(fd_, kZeroRange, offset, n) != 0) {
+            throw IO_EXCEPTION(fname_);
+        }
+    }
+
+    void PosixWritableFile::TrimPreallocation() {
+        // filesize_ 只是本对象写入的大小, 未预分配也未移动区间时不能截断, 否则会截掉其他 O_APPEND 写入者的数据
+        if (last_preallocated_block_ == 0 && !range_changed_) {
+            return;
+        }
+        range_changed_ = false;
+        struct stat sbuf;
+        if (fstat(fd_, &sbuf) != 0) {
+            return;
+        }
+        if (static_cast<size_t>(sbuf.st_size) != filesize_) {
+            ftruncate(fd_, static_cast<off_t>(filesize_));
+        }
+#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE) && defined(FALLOC_FL_PUNCH_HOLE)
+        auto blksize = static_cast<size_t>(sbuf.st_blksize);
+        if (last_preallocated_block_ > 0 && kPreallocationBlockSize * last_preallocated_block_ > filesize_ &&
+            (filesize_ + blksize - 1) / blksize != static_cast<size_t>(sbuf.st_blocks) / (blksize / 512)) {
+            fallocate(fd_, FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE, filesize_,
+                      kPreallocationBlockSize * last_preallocated_block_ - filesize_);
+        }
+#endif
+        last_preallocated_block_ = 0;
+    }
+
+    int PosixWritableFile::FallocateRange(int fd, RangeOp op, size_t offset, size_t n) {
+        auto off = static_cast<off_t>(offset);
+        auto len = static_cast<off_t>(n);
+        int r = -1;
+        errno = EOPNOTSUPP;
+        switch (op) {
+            case kPunchHole: {
+#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE) && defined(FALLOC_FL_PUNCH_HOLE)
+                r = fallocate(fd, FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE, off, len);
+#elif defined(PENV_OS_MACOSX) && defined(F_PUNCHHOLE)
+                fpunchhole_t args = {0, 0, off, len};
+                r = fcntl(fd, F_PUNCHHOLE, &args);
+#endif
+                break;
+            }
+            case kCollapseRange:
+#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_COLLAPSE_RANGE)
+                r = fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, off, len);
+#endif
+                break;
+            case kInsertRange:
+#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_INSERT_RANGE)
+                r = fallocate(fd, FALLOC_FL_INSERT_RANGE, off, len);
+#endif
+                break;
+            default:
+                assert(op == kZeroRange);
+#if defined(PENV_OS_LINUX) && defined(FALLOC_FL_ZERO_RANGE)
+                r = fallocate(fd, FALLOC_FL_KEEP_SIZE | FALLOC_FL_ZERO_RANGE, off, len);
+                // 部分文件系统只支持打洞, 打洞后重新分配等价于置零
+                if (r != 0 && errno == EOPNOTSUPP) {
+                    r = FallocateRange(fd, kPunchHole, offset, n);
+                    if (r == 0) {
+                        r = fallocate(fd, FALLOC_FL_KEEP_SIZE, off, len);
+                    }
+                }
+#endif
+                break;
+        }
+        return r;
+    }
 }
\ No newline at end of file
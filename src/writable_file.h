@@ -6,7 +6,18 @@
 
 namespace penv {
     class PosixWritableFile : public WritableFile {
+    public:
+        enum TempKind {
+            kNotTemp,
+            // O_TMPFILE 创建的匿名文件, fname_ 为所在目录
+            kAnonymousTemp,
+            // 不支持 O_TMPFILE 时的带名临时文件, 未发布则析构时删除
+            kNamedTemp
+        };
+
     private:
+        friend class PosixMmapWritableFile;
+
         enum {
             kPreallocationBlockSize = 4 * 1024 * 1024
         };
@@ -14,17 +25,25 @@ namespace penv {
         std::string fname_;
         size_t filesize_;
         size_t last_preallocated_block_;
+        // CollapseRange/InsertRange 后磁盘上的大小可能与 filesize_ 不一致
+        bool range_changed_;
         int fd_;
+        TempKind temp_;
 
     public:
-        PosixWritableFile(std::string fname, size_t filesize, int fd)
+        PosixWritableFile(std::string fname, size_t filesize, int fd, TempKind temp = kNotTemp)
                 : fname_(std::move(fname)),
                   filesize_(filesize),
                   last_preallocated_block_(0),
-                  fd_(fd) {}
+                  range_changed_(false),
+                  fd_(fd),
+                  temp_(temp) {}
 
         ~PosixWritableFile() override;
 
+        // 同步数据并原子地发布为 fname, 已存在则覆盖; 不同步所在目录
+        void Publish(const std::string & fname);
+
     public:
         void Write(const Slice & data) override;
 
@@ -32,6 +51,10 @@ namespace penv {
 
         void Sync() override;
 
+        Status TryWrite(const Slice & data) noexcept override;
+
+        Status TrySync() noexcept override;
+
         size_t GetFileSize() const override {
             return filesize_;
         }
@@ -43,6 +66,24 @@ namespace penv {
         void PrepareWrite(size_t offset, size_t n) override;
 
         void Allocate(size_t offset, size_t n) override;
+
+        void PunchHole(size_t offset, size_t n) override;
+
+        void CollapseRange(size_t offset, size_t n) override;
+
+        void InsertRange(size_t offset, size_t n) override;
+
+        void ZeroRange(size_t offset, size_t n) override;
+
+    private:
+        void TrimPreallocation();
+
+        enum RangeOp {
+            kPunchHole, kCollapseRange, kInsertRange, kZeroRange
+        };
+
+        // 不支持时置 errno 为 EOPNOTSUPP 并返回非 0, 与 PosixMmapWritableFile 共用
+        static int FallocateRange(int fd, RangeOp op, size_t offset, size_t n);
     };
 }
 
@@ -0,0 +1,48 @@
+#include <cstring>
+#include <iostream>
+
+#include "src/trace_env.h"
+
+// 用法: trace_replay <trace> [--fast] [--rewrite <from>=<to>]
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <trace> [--fast] [--rewrite <from>=<to>]" << std::endl;
+        return 1;
+    }
+
+    penv::TraceReplayOptions options;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            options.fast = true;
+        } else if (strcmp(argv[i], "--rewrite") == 0 && i + 1 < argc) {
+            std::string rule = argv[++i];
+            size_t sep = rule.find('=');
+            if (sep == std::string::npos) {
+                std::cerr << "bad rewrite rule: " << rule << std::endl;
+                return 1;
+            }
+            options.from_prefix = rule.substr(0, sep);
+            options.to_prefix = rule.substr(sep + 1);
+        } else {
+            std::cerr << "unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    penv::TraceReplayer replayer(penv::Env::Default(), argv[1]);
+    penv::TraceReplayStats stats = replayer.Replay(options);
+
+    double seconds = stats.elapsed_nanos / 1e9;
+    std::cout << "ops:          " << stats.ops << " (" << stats.errors << " errors)" << std::endl;
+    std::cout << "elapsed:      " << seconds << " s (trace " << stats.trace_elapsed_nanos / 1e9 << " s)"
+              << std::endl;
+    std::cout << "throughput:   " << (seconds > 0 ? stats.ops / seconds : 0) << " ops/s, "
+              << (seconds > 0 ? stats.bytes_read / seconds / 1048576 : 0) << " MB/s read, "
+              << (seconds > 0 ? stats.bytes_written / seconds / 1048576 : 0) << " MB/s write" << std::endl;
+    std::cout << "latency(us):  avg " << stats.avg_latency / 1e3
+              << " p50 " << stats.p50_latency / 1e3
+              << " p99 " << stats.p99_latency / 1e3
+              << " max " << stats.max_latency / 1e3
+              << " (trace avg " << stats.trace_avg_latency / 1e3 << ")" << std::endl;
+    return 0;
+}